@@ -37,16 +37,28 @@
 #include <map>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <random>
 
 #include <CGRA/CGRA.h>
 #include <CGRA/OpGraph.h>
 #include <CGRA/Mapper.h>
 #include <CGRA/Mapping.h>
+#include <CGRA/Router.h>
 
+// A single mapping change, recorded so that a rejected move can be undone
 typedef struct
 {
-    std::map<OpGraphNode*, std::vector<MRRGNode*>> mapping;
-} OpMapping;
+    OpGraphNode* opnode;
+    MRRGNode* node;
+    bool mapped; // true if node was mapped to opnode, false if it was unmapped
+} JournalEntry;
+
+enum class AnnealSchedule
+{
+    CONSTANT,   // temperature multiplied by constant_temp_factor every step
+    ADAPTIVE    // cooling rate depends on the acceptance rate, with reheating on stagnation
+};
 
 class AnnealMapper : public Mapper
 {
@@ -69,19 +81,73 @@ class AnnealMapper : public Mapper
         float   const_temp_factor;
         int     swap_factor;
         float   cold_accept_rate;
+        bool    negotiated_router;
+        int     negotiated_router_iterations;
+        float   astar_factor;
+        int     num_replicas;
+        int     exchange_interval;
+        bool    range_limit;
+        AnnealSchedule anneal_schedule;
+        int     stagnation_steps;
+        float   reheat_factor;
+        int     max_reheats;
+        bool    placement_only;
+        int     route_interval;
+        int     multi_start;
+        int     abandon_interval;
+        float   abandon_margin;
+        std::string checkpoint_file;
+        int     checkpoint_interval;
+        std::string resume_file;
         float   updateTempConst(float temp);
+        float   updateTemperature(float temp, float acceptance_rate);
+
+        std::unique_ptr<Mapper> clone() const override;
+        void    updateOpGraph(OpGraph* opgraph) override;
 
     private:
+        Mapping mapOpGraphParallel(std::shared_ptr<OpGraph> opgraph, int II);
+        Mapping mapOpGraphMultiStart(std::shared_ptr<OpGraph> opgraph, int II);
+        std::unique_ptr<AnnealMapper> makeReplica(int stream, const std::atomic<bool>* stop);
+        bool annealStep(OpGraph* opgraph, MRRG* mrrg, float* temperature, float* accept_rate, AnnealSchedule schedule);
+        void resetMapping(OpGraph* opgraph, MRRG* mrrg);
+        void initialPlacement(OpGraph* opgraph, MRRG* mrrg);
+        void initialPlaceAndRoute(OpGraph* opgraph, MRRG* mrrg);
+
+        // checkpointing of the single chain annealer
+        void saveCheckpoint(OpGraph* opgraph, MRRG* mrrg, int II, float temperature, float best_cost, int stagnant_steps, int reheats);
+        void loadCheckpoint(OpGraph* opgraph, MRRG* mrrg, int II, float* temperature, float* best_cost, int* stagnant_steps, int* reheats);
+        float initialTemperature(OpGraph* opgraph, MRRG* mrrg, float accept_percentage = 0.99);
+
+        // placement only annealing against a routing estimate
+        bool annealPlacement(OpGraph* opgraph, MRRG* mrrg, double start_time);
+        float placementMove(OpGraph* opgraph, MRRG* mrrg, OpGraphOp* op, MRRGNode* fu, float temperature, bool* accepted, bool undo = false);
+        float getEdgeEstimate(MRRG* mrrg, OpGraphVal* val, unsigned int i);
+        float getOpEstimate(MRRG* mrrg, OpGraphOp* op, OpGraphOp* other);
+        float getPlacementCost(OpGraph* opgraph, MRRG* mrrg);
         bool inner_place_and_route_loop(OpGraph* opgraph, MRRG* mrrg, float temp, float* accept_rate);
+        MRRGNode* getRandomFU(MRRG* mrrg, OpGraphOp* op);
         MRRGNode* getCandidateFU(MRRG* mrrg, OpGraphOp* op);
+        void updateRangeLimit(float accept_rate);
+        // range limiter window, in routing hops from the FU of the moved op
+        float range_limit_dist;
+        int max_range_limit_dist;
+        std::vector<MRRGNode*> range_candidates;
         MRRGNode* getRandomUnoccupiedFU(MRRG* mrrg, OpGraphOp* op);
         OpGraphOp* getOpNodePtr(OpGraph* opgraph, MRRGNode* n);
 
-        OpMapping ripUpOp(OpGraphOp* op, float* cost = NULL);
-        void restoreOp(OpMapping oldmap);
+        void ripUpOp(OpGraphOp* op, float* cost = NULL);
+
+        // moves, all mapping changes between beginMove() and rollbackMove() are undone
+        void beginMove();
+        void commitMove();
+        void rollbackMove();
+        std::vector<JournalEntry> journal;
+        bool journaling = false;
 
         bool routeOp(OpGraphOp* op, MRRG* mrrg);
-        bool routeVal(OpGraphVal* val);
+        bool routeVal(OpGraphVal* val, MRRG* mrrg);
+        bool routeNegotiated(OpGraph* opgraph, MRRG* mrrg);
         bool placeOp(OpGraphOp* op, MRRGNode* n);
 
         bool checkOveruse(MRRG* mrrg);
@@ -89,18 +155,46 @@ class AnnealMapper : public Mapper
         // mapping/unmapping
         void  mapMRRGNode(OpGraphNode*, MRRGNode* node);
         void  unmapMRRGNode(OpGraphNode*, MRRGNode* node);
-        std::vector<MRRGNode*> unmapAllMRRGNodes(OpGraphNode*);
+        void unmapAllMRRGNodes(OpGraphNode*);
         void mapAllMRRGNodes(OpGraphNode*, std::vector<MRRGNode*> nodes);
         MRRGNode* getMappedMRRGNode(OpGraphOp* op);
-
-        // mapping and occupancy
-        std::map<MRRGNode*,int> occupancy;
-        std::map<OpGraphNode*, std::vector<MRRGNode*>> mapping;
+        std::map<OpGraphNode*, std::vector<MRRGNode*>> getMapping(OpGraph* opgraph);
+        void applyOutputLatency(OpGraph* opgraph);
+
+        // mapping and occupancy, indexed by OpGraphNode::id and MRRGNode::id
+        std::vector<int> occupancy;
+        std::vector<std::vector<MRRGNode*>> mapping;
+        // ops placed on each function node, indexed by MRRGNode::id (function nodes come first)
+        std::vector<std::vector<OpGraphOp*>> placed_ops;
+        void addPlacedOp(OpGraphNode* opnode, MRRGNode* n);
+        void removePlacedOp(OpGraphNode* opnode, MRRGNode* n);
+        // path latencies of the routed vals, only written to the OpGraph once mapped
+        std::vector<std::vector<unsigned int>> output_latency;
+
+        // random stream, private to each mapper so that replicas can run in parallel
+        std::mt19937 rng;
+        void seedRandom(int stream);
+        int randInt(int n);
+        float randFloat();
+        bool accept(float delta_cost, float temperature);
+        bool accept(float new_cost, float old_cost, float temperature);
+
+        // replicas stop once another replica has found a mapping
+        const std::atomic<bool>* stop_flag = NULL;
+
+        // running total of getCost(MRRGNode*) over all MRRG nodes
+        double total_cost;
+
+        // router search state and buffers
+        RouterScratch scratch;
+        std::vector<MRRGNode*> sinks;
+        std::vector<MRRGNode*> route_tree;
 
         // Costing
         float getTotalOpCost(OpGraphOp* op);
         float getCost(MRRGNode* n);
         float getCost(MRRG* n);
+        float recomputeCost(MRRG* n);
         float getCost(OpGraphNode* n);
         float getCost(OpGraph* opgraph);
         bool compare_mrrg_node_cost(MRRGNode* a, MRRGNode* b);
@@ -35,6 +35,7 @@
 
 #include <string>
 #include <map>
+#include <memory>
 
 #include <CGRA/CGRA.h>
 #include <CGRA/OpGraph.h>
@@ -59,6 +60,12 @@ enum class ILPMapperStatus
     UNLISTED_STATUS
 };
 
+// MRRG side of the ILP model and the templates built so far, defined in ILPMapper.cpp
+struct ILPArchTemplate;
+struct ILPArchTemplateCache;
+// placement only ILP of the decomposed mapper, defined in ILPMapper.cpp
+struct ILPPlacementModel;
+
 class ILPMapper : public Mapper
 {
     public:
@@ -68,16 +75,47 @@ class ILPMapper : public Mapper
 
         Mapping mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II) override;
 
+        // Gives a mapping to the solver as the initial solution, used when mapping at the same II, but not by the decomposed mapper
+        void setWarmStart(const Mapping & mapping);
+
+    protected:
+        std::unique_ptr<Mapper> clone() const override;
+
     private:
         ILPSolverType solvertype;
 
-        ILPMapperStatus SCIPMap(OpGraph* opgraph, int II, Mapping* mapping);
+        // Warm start, with a given mapping or one found by the AnnealMapper
+        bool   warm_start;
+        double warm_start_timelimit;
+        std::map<std::string, std::string> warm_start_args;
+        std::map<OpGraphNode*, std::vector<MRRGNode*>> warm_start_mapping;
+        int    warm_start_II = 0;
+
+        // Anchor one op to context 0 when the MRRG is the same in every context
+        bool   symmetry_breaking;
+
+        // Add the fanout routing constraints (Constraint 4) only once a solution violates them
+        bool   lazy_routing;
+
+        // Decomposed mapping, a placement ILP followed by the negotiated router with no-good cuts on failure
+        bool   decomposed;
+        int    decomposed_max_distance;
+        int    decomposed_router_iterations;
+        ILPMapperStatus mapDecomposed(OpGraph* opgraph, const ILPArchTemplate & arch, Mapping* mapping, OpGraphOp* anchor);
+
+        // Architecture templates by II, shared by every DFG mapped with this mapper and by its copies in an II sweep
+        std::shared_ptr<ILPArchTemplateCache> arch_templates;
+        std::shared_ptr<ILPArchTemplate> getArchTemplate(int II);
+
+        ILPMapperStatus SCIPMap(OpGraph* opgraph, const ILPArchTemplate & arch, Mapping* mapping, const std::map<OpGraphNode*, std::vector<MRRGNode*>>* start, OpGraphOp* anchor);
+        ILPMapperStatus SCIPPlace(OpGraph* opgraph, const ILPPlacementModel & model, double timelimit, std::vector<MRRGNode*> & placement);
         // SCIP data member
         double scip_mipgap;
         int    scip_solnlimit;
 
 #ifdef USE_GUROBI
-        ILPMapperStatus GurobiMap(OpGraph* opgraph, int II, Mapping* mapping);
+        ILPMapperStatus GurobiMap(OpGraph* opgraph, const ILPArchTemplate & arch, Mapping* mapping, const std::map<OpGraphNode*, std::vector<MRRGNode*>>* start, OpGraphOp* anchor);
+        ILPMapperStatus GurobiPlace(OpGraph* opgraph, const ILPPlacementModel & model, double timelimit, std::vector<MRRGNode*> & placement);
         // Gurobi data member
         double grb_mipgap;
         int    grb_solnlimit;
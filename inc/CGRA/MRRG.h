@@ -37,6 +37,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <atomic>
 
 #include <CGRA/OpGraph.h>
 
@@ -74,10 +76,13 @@ class MRRGNode
 
         bool canMapOp(OpGraphOp const * op);
         std::vector<OpGraphOpCode> supported_ops;
+        // bit i is set if opcode i is in supported_ops, built by MRRG::finalize()
+        unsigned int supported_ops_mask;
 
         std::vector<MRRGNode*>  fanout;
         std::vector<MRRGNode*>  fanin;
         std::map<int, MRRGNode*> operand;
+        // FUs reachable from this FU with their distance in routing nodes, sorted by distance
         std::vector<std::pair<MRRGNode*, int> > neighbourFUs;
 
         Module* parent;
@@ -97,8 +102,9 @@ class MRRGNode
         // the capacity of the node, how many things can be mapped to it
         int     capacity;
 
-        // variable
-        MRRGNode* prev;
+        // dense index of this node in the MRRG, assigned by MRRG::finalize()
+        unsigned int id;
+
 /*
         // fixed mapper data
         float   base_cost;
@@ -119,7 +125,7 @@ class MRRGNode
 class MRRG
 {
     public:
-        MRRG(int II)
+        MRRG(int II) : lookahead_built(false)
         {
             this->II = II;
             nodes.resize(II);
@@ -134,6 +140,9 @@ class MRRG
         bool verify();
 
         unsigned int II;
+        // number of nodes that were given an id by finalize()
+        unsigned int getNumNodes() const { return function_nodes.size() + routing_nodes.size(); }
+
         void print_dot();
         void print_dot_clustered();
 
@@ -141,6 +150,32 @@ class MRRG
 
         std::vector<MRRGNode*> function_nodes;
         std::vector<MRRGNode*> routing_nodes;
+
+        // function nodes that can map each opcode, indexed by OpGraphOpCode
+        std::vector<std::vector<MRRGNode*>> function_nodes_by_opcode;
+
+        // Router lookahead: a lower bound on the number of nodes a route from n has to add to reach
+        // any operand of the function node that the operand node sink belongs to (not sink itself),
+        // LOOKAHEAD_UNREACHABLE if there is no such route.
+        // The table is function nodes x MRRG nodes, so it is only built by the first query after
+        // finalize(). Concurrent routers can query it.
+        static const unsigned short LOOKAHEAD_UNREACHABLE = 0xffff;
+        unsigned short getLookahead(const MRRGNode* n, const MRRGNode* sink) const
+        {
+            if(!lookahead_built.load(std::memory_order_acquire))
+                buildLookahead();
+            return lookahead[lookahead_row[sink->id]][n->id];
+        }
+
+    private:
+        void buildLookahead() const;
+
+        // lookahead distances, one row per function node (by id) to any of its operands,
+        // lookahead_row maps an operand node id to its row
+        mutable std::vector<std::vector<unsigned short>> lookahead;
+        mutable std::vector<unsigned int> lookahead_row;
+        mutable std::atomic<bool> lookahead_built;
+        mutable std::mutex lookahead_mutex;
 };
 
 #endif
@@ -36,6 +36,7 @@
 #include <map>
 #include <vector>
 #include <iostream>
+#include <atomic>
 
 #include <CGRA/CGRA.h>
 #include <CGRA/OpGraph.h>
@@ -50,10 +51,20 @@ enum class MapperType
 class Mapper
 {
     public:
+        // Maps at the lowest II from 1 to cgra->maxII, the IIs are tried in parallel
         virtual Mapping mapOpGraph(std::shared_ptr<OpGraph> opgraph);
         virtual Mapping mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II) = 0;
         void genBitstream();
 
+        // Runs this mapper as one attempt of an II sweep: mapOpGraph() is quiet, gives up as soon as possible once
+        // cancel is set, and leaves the OpGraph, which is shared by all attempts, to updateOpGraph()
+        void setSweepAttempt(const std::atomic<bool>* cancel) { cancel_flag = cancel; ii_sweep = true; verbose = false; }
+
+        // Lower bounds on the II of a mapping, from the function nodes (ResMII) and from the cycles of the OpGraph (RecMII).
+        // RecMII is a placeholder until the OpGraph has iteration distances, see getRecMII()
+        int getResMII(OpGraph* opgraph);
+        int getRecMII(OpGraph* opgraph);
+
 
         virtual ~Mapper();
         static std::unique_ptr<Mapper> createMapper(MapperType mt, std::shared_ptr<CGRA> cgra, int timelimit, const std::map<std::string, std::string> & args);
@@ -63,6 +74,16 @@ class Mapper
 
         std::shared_ptr<CGRA>   cgra;       // Architecture Object
         int     timelimit;  // The mapper timeout in seconds
+
+        // II sweep support, a copy of this mapper with the same options maps each II
+        virtual std::unique_ptr<Mapper> clone() const = 0;
+        // writes the results of the last mapping that are kept on the OpGraph
+        virtual void updateOpGraph(OpGraph* /*opgraph*/) {}
+        bool cancelled() const { return cancel_flag && *cancel_flag; }
+        const std::atomic<bool>* cancel_flag = NULL;
+        bool    ii_sweep = false;
+        // progress and diagnostics are only printed if set, the attempts of an II sweep are quiet
+        bool    verbose = true;
 };
 
 #endif
@@ -63,6 +63,7 @@ typedef enum
     OPGRAPH_OP_GEP,
     OPGRAPH_OP_ICMP,
     OPGRAPH_OP_SHR,
+    OPGRAPH_OP_NUM_OPCODES, // Number of opcodes, must be last
 } OpGraphOpCode;
 
 std::ostream& operator <<(std::ostream &os, const OpGraphOpCode &opcode);
@@ -79,10 +80,14 @@ class OpGraphNode
         OpGraphNode(std::string name)
         {
             this->name = name;
+            this->id = 0;
         };
         virtual ~OpGraphNode();
 
         std::string name;
+
+        // dense index of this node in the OpGraph, assigned by OpGraph::finalize()
+        unsigned int id;
 };
 
 class OpGraphVal;
@@ -151,6 +156,9 @@ class OpGraph
         OpGraph();              // creates an empty OpGraph
         ~OpGraph();
 
+        // assigns dense ids to all nodes, ops first followed by vals. Must be called once the graph is built
+        void finalize();
+
         //float getCost(float pfactor);
         int getMaxCycle();
 
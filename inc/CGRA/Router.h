@@ -0,0 +1,310 @@
+/*******************************************************************************
+ * CGRA-ME Software End-User License Agreement
+ *
+ * The software programs comprising "CGRA-ME" and the documentation provided
+ * with them are copyright by its authors S. Chin, K. Niu, N. Sakamoto, J. Zhao,
+ * A. Rui, S. Yin, A. Mertens, J. Anderson, and the University of Toronto. Users
+ * agree to not redistribute the software, in source or binary form, to other
+ * persons or other institutions. Users may modify or use the source code for
+ * other non-commercial, not-for-profit research endeavours, provided that all
+ * copyright attribution on the source code is retained, and the original or
+ * modified source code is not redistributed, in whole or in part, or included
+ * in or with any commercial product, except by written agreement with the
+ * authors, and full and complete attribution for use of the code is given in
+ * any resulting publications.
+ *
+ * Only non-commercial, not-for-profit use of this software is permitted. No
+ * part of this software may be incorporated into a commercial product without
+ * the written consent of the authors. The software may not be used for the
+ * design of a commercial electronic product without the written consent of the
+ * authors. The use of this software to assist in the development of new
+ * commercial CGRA architectures or commercial soft processor architectures is
+ * also prohibited without the written consent of the authors.
+ *
+ * This software is provided "as is" with no warranties or guarantees of
+ * support.
+ *
+ * This Agreement shall be governed by the laws of Province of Ontario, Canada.
+ *
+ * Please contact Prof. Anderson if you are interested in commercial use of the
+ * CGRA-ME framework.
+ ******************************************************************************/
+
+#ifndef ___ROUTER_H__
+#define ___ROUTER_H__
+
+#include <vector>
+#include <map>
+#include <queue>
+#include <algorithm>
+
+#include <CGRA/MRRG.h>
+#include <CGRA/OpGraph.h>
+
+// Per router search state, indexed by MRRGNode::id. The entries of a node are only
+// valid if it was visited in the current generation, so clearing is O(1) and the
+// router never has to write to the (shared) MRRG nodes.
+// Route tree and sink membership are stamped the same way, but only reset once per val.
+class RouterScratch
+{
+    public:
+        void resize(unsigned int num_nodes)
+        {
+            prev.assign(num_nodes, NULL);
+            cost.assign(num_nodes, 0.0);
+            visited.assign(num_nodes, 0);
+            generation = 1;
+
+            tree.assign(num_nodes, 0);
+            sink.assign(num_nodes, -1);
+            sink_stamp.assign(num_nodes, 0);
+            tree_generation = 1;
+        }
+
+        // forget all visited nodes
+        void clear()
+        {
+            if(++generation == 0) // wrapped around, old stamps would look valid again
+            {
+                std::fill(visited.begin(), visited.end(), 0);
+                generation = 1;
+            }
+        }
+
+        bool isVisited(const MRRGNode* n) const { return visited[n->id] == generation; }
+        void visit(MRRGNode* n, MRRGNode* p, float c) { prev[n->id] = p; cost[n->id] = c; visited[n->id] = generation; }
+
+        // only valid for visited nodes
+        MRRGNode* getPrev(const MRRGNode* n) const { return prev[n->id]; }
+        float getCost(const MRRGNode* n) const { return cost[n->id]; }
+
+        // forget the route tree and all sinks
+        void clearTree()
+        {
+            if(++tree_generation == 0)
+            {
+                std::fill(tree.begin(), tree.end(), 0);
+                std::fill(sink_stamp.begin(), sink_stamp.end(), 0);
+                tree_generation = 1;
+            }
+        }
+
+        bool inTree(const MRRGNode* n) const { return tree[n->id] == tree_generation; }
+        void addToTree(const MRRGNode* n) { tree[n->id] = tree_generation; }
+
+        // sink index of n, -1 if n is not a sink
+        int getSink(const MRRGNode* n) const { return sink_stamp[n->id] == tree_generation ? sink[n->id] : -1; }
+        void setSink(const MRRGNode* n, int index) { sink[n->id] = index; sink_stamp[n->id] = tree_generation; }
+
+    private:
+        std::vector<MRRGNode*> prev;
+        std::vector<float> cost;
+        std::vector<unsigned int> visited;
+        unsigned int generation;
+
+        std::vector<unsigned int> tree;
+        std::vector<int> sink;
+        std::vector<unsigned int> sink_stamp;
+        unsigned int tree_generation;
+};
+
+// orders the router queue by least cost first
+struct RouterQueueCompare
+{
+    bool operator()(const std::pair<float, MRRGNode*> & a, const std::pair<float, MRRGNode*> & b) const { return a.first > b.first; }
+};
+
+// Routes a single val from src to all of its sinks (FU operand nodes) by growing a route tree,
+// one least cost path at a time. cost(n) is the cost of adding the MRRG node n to the tree.
+// If astar_factor is not zero, each search is guided towards the nearest remaining sink, using
+// astar_factor times the MRRG lookahead as the estimate of the remaining cost. Nodes are marked
+// visited when they are queued and keep the first path that reached them, so each search is a
+// greedy best-first expansion: the path found is not always the least cost one, with or without
+// the estimate.
+// On success tree holds the route tree, including src and the sinks, and sink_latency[i] is
+// the latency of the path to sinks[i]. Returns false if a sink is unreachable.
+template<typename CostFunc>
+bool routeTree(RouterScratch& scratch, const MRRG& mrrg, float astar_factor, MRRGNode* src, const std::vector<MRRGNode*>& sinks, CostFunc cost, std::vector<MRRGNode*>& tree, std::vector<unsigned int>& sink_latency)
+{
+    tree.clear();
+    tree.push_back(src);
+    scratch.clearTree();
+    scratch.addToTree(src);
+
+    // the same operand node may be listed more than once
+    unsigned int unmapped_sinks = 0;
+    for(unsigned int i = 0; i < sinks.size(); ++i)
+    {
+        if(scratch.getSink(sinks[i]) < 0)
+        {
+            scratch.setSink(sinks[i], i);
+            unmapped_sinks++;
+        }
+    }
+    sink_latency.assign(sinks.size(), 0);
+
+    while(unmapped_sinks > 0)
+    {
+        // the A* target, the remaining sink closest to src
+        MRRGNode* target = NULL;
+        if(astar_factor != 0.0)
+        {
+            for(auto & s : sinks)
+            {
+                if(!scratch.inTree(s) && (!target || mrrg.getLookahead(src, s) < mrrg.getLookahead(src, target)))
+                    target = s;
+            }
+        }
+
+        // start a new search, this forgets every node visited by the previous one
+        scratch.clear();
+        for(auto s = tree.begin(); s != tree.end(); ++s)
+        {
+            scratch.visit(*s, NULL, 0.0);
+        }
+
+        // queued by cost + estimated remaining cost, the cost itself is kept in the scratch
+        std::priority_queue<std::pair<float, MRRGNode*>, std::vector<std::pair<float, MRRGNode*>>, RouterQueueCompare> queue;
+        auto push = [&](MRRGNode* n, MRRGNode* prev, float c)
+        {
+            float estimate = 0.0;
+            if(target)
+            {
+                unsigned short lookahead = mrrg.getLookahead(n, target);
+                // can't reach the target, prune unless it is another sink
+                if(lookahead == MRRG::LOOKAHEAD_UNREACHABLE && scratch.getSink(n) < 0)
+                    return;
+                if(lookahead != MRRG::LOOKAHEAD_UNREACHABLE)
+                    estimate = astar_factor * lookahead;
+            }
+            scratch.visit(n, prev, c);
+            queue.push(std::make_pair(c + estimate, n));
+        };
+
+        for(unsigned int s = 0; s < tree.size(); ++s)
+        {
+            for(auto n = tree[s]->fanout.begin(); n != tree[s]->fanout.end(); ++n)
+            {
+                // tree nodes are already visited
+                if(!scratch.isVisited(*n))
+                    push(*n, tree[s], cost(*n));
+            }
+        }
+
+        bool found_sink = false;
+        while(!queue.empty())
+        {
+            MRRGNode* n = queue.top().second;
+            float node_cost = scratch.getCost(n);
+            queue.pop();
+
+            if(scratch.getSink(n) >= 0 && !scratch.inTree(n))
+            {
+                // backtrack to the tree and add the path to it
+                tree.push_back(n);
+                scratch.addToTree(n);
+
+                unsigned int latency = 0;
+                MRRGNode* k = scratch.getPrev(n);
+                while(!scratch.inTree(k))
+                {
+                    latency += k->latency;
+                    tree.push_back(k);
+                    scratch.addToTree(k);
+                    k = scratch.getPrev(k);
+                }
+
+                sink_latency[scratch.getSink(n)] = latency;
+                unmapped_sinks--;
+                found_sink = true;
+
+                // the rest of the queue is discarded, the next search starts from the extended route tree
+                break;
+            }
+            else if(n->type == MRRG_NODE_ROUTING)
+            {
+                for(auto i = n->fanout.begin(); i != n->fanout.end(); ++i)
+                {
+                    if(!scratch.isVisited(*i))
+                        push(*i, n, node_cost + cost(*i));
+                }
+            }
+        }
+
+        // unreachable sink
+        if(!found_sink)
+            return false;
+    }
+
+    // duplicated sinks share the latency of the first one
+    for(unsigned int i = 0; i < sinks.size(); ++i)
+    {
+        sink_latency[i] = sink_latency[scratch.getSink(sinks[i])];
+    }
+
+    return true;
+}
+
+// PathFinder style negotiated congestion router. Given a placement of every op, all vals
+// are ripped up and rerouted each iteration with a cost that grows with the present
+// overuse of a node and with its overuse history, until no routing node is overused.
+class NegotiatedRouter
+{
+    public:
+        // every node costs at least 1, so astar_factor = 1 does not overestimate the remaining cost
+        NegotiatedRouter(MRRG* mrrg, int max_iterations = 50, float initial_present_factor = 0.5, float present_factor_mult = 1.5, float history_factor = 1.0, float astar_factor = 1.0);
+
+        // placement is indexed by OpGraphOp::id. Returns true if a legal routing was found,
+        // the routing and the path latencies are kept in the router, the OpGraph is not modified.
+        bool route(OpGraph* opgraph, const std::vector<MRRGNode*>& placement);
+
+        // number of iterations used by the last call to route()
+        int getIterations() const { return iterations; }
+
+        // the val that can not be routed at all is reported on std::cout if set (the default)
+        void setVerbose(bool verbose) { this->verbose = verbose; }
+
+        // routing nodes used by a val after route()
+        const std::vector<MRRGNode*>& getRoute(const OpGraphVal* val) const { return routes[val->id]; }
+        // path latency to each output of a val after route()
+        const std::vector<unsigned int>& getOutputLatency(const OpGraphVal* val) const { return latencies[val->id]; }
+
+        // after a failed route(), the val that could not be routed (NULL if none) and the routing nodes left overused
+        OpGraphVal* getUnroutableVal() const { return unroutable_val; }
+        const std::vector<MRRGNode*>& getOverusedNodes() const { return overused_nodes; }
+
+        // placement and routing in the form used by Mapping
+        std::map<OpGraphNode*, std::vector<MRRGNode*>> getMapping(OpGraph* opgraph) const;
+
+    private:
+        float getCost(MRRGNode* n) const;
+        void ripUpVal(OpGraphVal* val);
+        bool routeVal(OpGraphVal* val, const std::vector<MRRGNode*>& placement);
+
+        MRRG*   mrrg;
+        int     max_iterations;
+        float   initial_present_factor;
+        float   present_factor_mult;
+        float   history_factor;
+        float   astar_factor;
+        bool    verbose;
+
+        // state of the current route() call, indexed by MRRGNode::id and OpGraphNode::id
+        float   present_factor;
+        int     iterations;
+        std::vector<int> occupancy;
+        std::vector<float> history;
+        std::vector<std::vector<MRRGNode*>> routes;
+        std::vector<std::vector<unsigned int>> latencies;
+        std::vector<MRRGNode*> placed;
+        OpGraphVal* unroutable_val;
+        std::vector<MRRGNode*> overused_nodes;
+
+        RouterScratch scratch;
+        std::vector<MRRGNode*> sinks;
+        std::vector<MRRGNode*> tree;
+        std::vector<unsigned int> latency;
+};
+
+#endif
+
@@ -36,6 +36,14 @@
 #include <queue>
 #include <functional>
 
+#include <thread>
+#include <atomic>
+#include <random>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <cstdio>
+
 #include <assert.h>
 #include <sys/time.h>
 
@@ -48,16 +56,27 @@ using std::cout;
 using std::endl;
 
 #define ALLOW_MULTIPLE_PLACEMENT
-#define SIMPLE_ANNEAL_SCHEDULE
 #define CALCULATE_INITIAL_TEMPERATURE
 // Debugging output flags
 //#define ANNEAL_DEBUG
 //#define PLACEMENT_DEBUG
 //#define DEBUG_ROUTING
 
+// relative cost improvement that resets the stagnation count of the adaptive schedule
+#define STAGNATION_TOLERANCE 0.001
+
+// placement only mode: estimated cost of an edge between FUs that can't reach each other,
+// and the acceptance rate the routing annealer starts at if the placement can't be routed
+#define UNREACHABLE_EDGE_COST 1000.0
+#define FALLBACK_ACCEPT_RATE 0.1
+
+// ratio between the hottest and the coldest replica temperature
+#define REPLICA_TEMPERATURE_SPAN 1000.0
+
 AnnealMapper::AnnealMapper(std::shared_ptr<CGRA> cgra, int timelimit, const std::map<std::string, std::string> & args)
     : Mapper(cgra, timelimit)
 {
+    std::string schedule;
     try
     {
         rand_seed = std::stoi(args.at("AnnealMapper.random_seed"));
@@ -66,12 +85,53 @@ AnnealMapper::AnnealMapper(std::shared_ptr<CGRA> cgra, int timelimit, const std:
         const_temp_factor = std::stof(args.at("AnnealMapper.constant_temp_factor"));
         swap_factor = std::stoi(args.at("AnnealMapper.swap_factor"));
         cold_accept_rate = std::stof(args.at("AnnealMapper.cold_accept_rate"));
+        negotiated_router = std::stoi(args.at("AnnealMapper.negotiated_router"));
+        negotiated_router_iterations = std::stoi(args.at("AnnealMapper.negotiated_router_iterations"));
+        astar_factor = std::stof(args.at("AnnealMapper.astar_factor"));
+        num_replicas = std::stoi(args.at("AnnealMapper.num_replicas"));
+        exchange_interval = std::stoi(args.at("AnnealMapper.exchange_interval"));
+        range_limit = std::stoi(args.at("AnnealMapper.range_limit"));
+        stagnation_steps = std::stoi(args.at("AnnealMapper.stagnation_steps"));
+        reheat_factor = std::stof(args.at("AnnealMapper.reheat_factor"));
+        max_reheats = std::stoi(args.at("AnnealMapper.max_reheats"));
+        placement_only = std::stoi(args.at("AnnealMapper.placement_only"));
+        route_interval = std::stoi(args.at("AnnealMapper.route_interval"));
+        multi_start = std::stoi(args.at("AnnealMapper.multi_start"));
+        abandon_interval = std::stoi(args.at("AnnealMapper.abandon_interval"));
+        abandon_margin = std::stof(args.at("AnnealMapper.abandon_margin"));
+        schedule = args.at("AnnealMapper.anneal_schedule");
+        checkpoint_file = args.at("AnnealMapper.checkpoint_file");
+        checkpoint_interval = std::stoi(args.at("AnnealMapper.checkpoint_interval"));
+        resume_file = args.at("AnnealMapper.resume_file");
     }
     catch(const std::exception & e)
     {
         throw cgrame_error(std::string("AnnealMapper Parameter Parsing Exception Thrown by: [") + e.what() + "] at File: " + std::string(__FILE__) + " Line: " + std::to_string(__LINE__));
     }
+
+    std::transform(schedule.begin(), schedule.end(), schedule.begin(), ::tolower);
+    if(schedule == "constant")
+        anneal_schedule = AnnealSchedule::CONSTANT;
+    else if(schedule == "adaptive")
+        anneal_schedule = AnnealSchedule::ADAPTIVE;
+    else
+        throw cgrame_error("AnnealMapper Parameter Parsing Exception: unknown anneal_schedule \"" + schedule + "\"");
+
+    // the intervals are in temperature steps, a step count of 0 would never move anything
+    if(exchange_interval <= 0)
+        throw cgrame_error("AnnealMapper Parameter Parsing Exception: exchange_interval must be at least 1");
+    if(route_interval <= 0)
+        throw cgrame_error("AnnealMapper Parameter Parsing Exception: route_interval must be at least 1");
+    if(abandon_interval <= 0)
+        throw cgrame_error("AnnealMapper Parameter Parsing Exception: abandon_interval must be at least 1");
+    if(checkpoint_interval <= 0)
+        throw cgrame_error("AnnealMapper Parameter Parsing Exception: checkpoint_interval must be at least 1");
+
+    // only the single chain annealer writes and resumes checkpoints
+    if((num_replicas > 1 || multi_start > 1) && (!checkpoint_file.empty() || !resume_file.empty()))
+        throw cgrame_error("AnnealMapper Parameter Parsing Exception: checkpoints are not supported with num_replicas or multi_start above 1");
 }
+
 AnnealMapper::AnnealMapper(std::shared_ptr<CGRA> cgra, int timelimit, int rand_seed, float initial_pfactor, float pfactor_factor, float const_temp_factor, int swap_factor, float cold_accept_rate)
     : Mapper(cgra, timelimit)
 {
@@ -82,6 +142,22 @@ AnnealMapper::AnnealMapper(std::shared_ptr<CGRA> cgra, int timelimit, int rand_s
     this->const_temp_factor = const_temp_factor;
     this->swap_factor = swap_factor;
     this->cold_accept_rate = cold_accept_rate;
+    this->negotiated_router = false;
+    this->negotiated_router_iterations = 50;
+    this->astar_factor = 0.0;
+    this->num_replicas = 1;
+    this->exchange_interval = 1;
+    this->range_limit = false;
+    this->anneal_schedule = AnnealSchedule::CONSTANT;
+    this->stagnation_steps = 20;
+    this->reheat_factor = 10.0;
+    this->max_reheats = 3;
+    this->placement_only = false;
+    this->route_interval = 10;
+    this->multi_start = 1;
+    this->abandon_interval = 10;
+    this->abandon_margin = 0.5;
+    this->checkpoint_interval = 10;
 }
 
 AnnealMapper::AnnealMapper(std::shared_ptr<CGRA> cgra)
@@ -98,10 +174,19 @@ float AnnealMapper::getCost(MRRGNode* n)
     else
         base_cost = 1.0;
 
-    return base_cost * occupancy[n] + (occupancy[n] <= n->capacity ? 0.0 : (occupancy[n] - n->capacity) * pfactor);
+    return base_cost * occupancy[n->id] + (occupancy[n->id] <= n->capacity ? 0.0 : (occupancy[n->id] - n->capacity) * pfactor);
+}
+
+// Returns the running total cost of the MRRG. The total is kept up to date by
+// mapMRRGNode()/unmapMRRGNode() so that only the nodes touched by a move are costed.
+float AnnealMapper::getCost(MRRG* /*mrrg*/)
+{
+    return total_cost;
 }
 
-float AnnealMapper::getCost(MRRG* mrrg)
+// Recomputes the total cost of the MRRG from scratch and resets the running total.
+// This has to be called whenever the cost function itself changes (i.e. pfactor).
+float AnnealMapper::recomputeCost(MRRG* mrrg)
 {
     float total = 0.0;
     for(auto & node: mrrg->function_nodes)
@@ -114,6 +199,7 @@ float AnnealMapper::getCost(MRRG* mrrg)
         total += getCost(node);
     }
 
+    total_cost = total;
     return total;
 }
 
@@ -135,14 +221,14 @@ float AnnealMapper::getCost(OpGraphNode * n)
 {
     float result = 0.0;
 
-    if(mapping[n].size() == 0)
+    if(mapping[n->id].size() == 0)
     {
         cout << "there's an unroute/unmap for OpGraphNode: " << n->name << "\n";
         result = INFINITY;
     }
     else
     {
-        for(auto & node : mapping[n])
+        for(auto & node : mapping[n->id])
         {
             result += getCost(node);
         }
@@ -155,18 +241,20 @@ bool AnnealMapper::checkOveruse(MRRG* mrrg)
     bool result = true;
     for(auto & node: mrrg->function_nodes)
     {
-        if(occupancy[node] > node->capacity)
+        if(occupancy[node->id] > node->capacity)
         {
-            std::cout << *node << " is overused. (" << occupancy[node] << "/" << node->capacity << ")\n";
+            if(verbose)
+                std::cout << *node << " is overused. (" << occupancy[node->id] << "/" << node->capacity << ")\n";
             result = false;
         }
     }
 
     for(auto & node: mrrg->routing_nodes)
     {
-        if(occupancy[node] > node->capacity)
+        if(occupancy[node->id] > node->capacity)
         {
-            std::cout << *node << " is overused. (" << occupancy[node] << "/" << node->capacity << ")\n";
+            if(verbose)
+                std::cout << *node << " is overused. (" << occupancy[node->id] << "/" << node->capacity << ")\n";
             result = false;
         }
     }
@@ -174,42 +262,47 @@ bool AnnealMapper::checkOveruse(MRRG* mrrg)
     return result;
 }
 
-OpGraphOp* AnnealMapper::getOpNodePtr(OpGraph* opgraph, MRRGNode* n)
+// Returns an op placed on the function node n, the one placed first if there are several
+OpGraphOp* AnnealMapper::getOpNodePtr(OpGraph* /*opgraph*/, MRRGNode* n)
 {
-    int size_vector = opgraph->op_nodes.size();
+    assert(n->type == MRRG_NODE_FUNCTION && !placed_ops[n->id].empty());
+
+    return placed_ops[n->id].front();
+}
 
-    OpGraphOp* return_ptr;
+// Keeps the reverse index of ops placed on each function node up to date
+void AnnealMapper::addPlacedOp(OpGraphNode* opnode, MRRGNode* n)
+{
+    if(n->type == MRRG_NODE_FUNCTION)
+        placed_ops[n->id].push_back(static_cast<OpGraphOp*>(opnode));
+}
 
-    //loop through all op nodes to find same MRRG node as 'this'
-    //may be very slow
-    for (int i = 0; i < size_vector; i++)
+void AnnealMapper::removePlacedOp(OpGraphNode* opnode, MRRGNode* n)
+{
+    if(n->type == MRRG_NODE_FUNCTION)
     {
-        MRRGNode* current_node = getMappedMRRGNode(opgraph->op_nodes[i]);
-        if(current_node == n)
-        {
-            return_ptr = opgraph->op_nodes[i];
-#ifdef DEBUG
-            // TODO: check only one occurance of op ptr
-#else
-            break;
-#endif
-        }
+        std::vector<OpGraphOp*>& ops = placed_ops[n->id];
+        ops.erase(find(ops.begin(), ops.end(), static_cast<OpGraphOp*>(opnode)));
     }
-
-    return return_ptr;
 }
 
 void AnnealMapper::mapMRRGNode(OpGraphNode* opnode, MRRGNode* n)
 {
     try
     {
-        mapping[opnode].push_back(n);
+        mapping[opnode->id].push_back(n);
     }
     catch(const std::exception & e)
     {
         throw cgrame_error(std::string("AnnealMapper Exception Thrown by: [") + e.what() + "] at File: " + std::string(__FILE__) + " Line: " + std::to_string(__LINE__));
     }
-    occupancy[n]++;
+    total_cost -= getCost(n);
+    occupancy[n->id]++;
+    total_cost += getCost(n);
+    addPlacedOp(opnode, n);
+
+    if(journaling)
+        journal.push_back({opnode, n, true});
 }
 
 void AnnealMapper::mapAllMRRGNodes(OpGraphNode* opnode, std::vector<MRRGNode*> nodes)
@@ -238,12 +331,18 @@ void AnnealMapper::unmapMRRGNode(OpGraphNode* opnode, MRRGNode* n)
 
     try
     {
-        auto iter = find(mapping[opnode].begin(), mapping[opnode].end(), n);
-        if(iter != mapping[opnode].end())
+        auto iter = find(mapping[opnode->id].begin(), mapping[opnode->id].end(), n);
+        if(iter != mapping[opnode->id].end())
         {
-            occupancy[n]--;
-            assert(occupancy[n] >= 0);
-            mapping[opnode].erase(iter);
+            total_cost -= getCost(n);
+            occupancy[n->id]--;
+            total_cost += getCost(n);
+            assert(occupancy[n->id] >= 0);
+            removePlacedOp(opnode, n);
+            mapping[opnode->id].erase(iter);
+
+            if(journaling)
+                journal.push_back({opnode, n, false});
         }
     }
     catch(const std::exception & e)
@@ -252,31 +351,67 @@ void AnnealMapper::unmapMRRGNode(OpGraphNode* opnode, MRRGNode* n)
     }
 }
 
-std::vector<MRRGNode*> AnnealMapper::unmapAllMRRGNodes(OpGraphNode* opnode)
+void AnnealMapper::unmapAllMRRGNodes(OpGraphNode* opnode)
 {
-    std::vector<MRRGNode*> result;
-
-    // save mapping
-    result = mapping[opnode];
+    std::vector<MRRGNode*>& nodes = mapping[opnode->id];
 
-    // unmap all nodes
-    for(auto & n: mapping[opnode])
+    // unmap all nodes, last to first so that a rollback maps them again in the same order
+    for(auto n = nodes.rbegin(); n != nodes.rend(); ++n)
     {
-        occupancy[n]--;
-        assert(occupancy[n] >= 0);
+        total_cost -= getCost(*n);
+        occupancy[(*n)->id]--;
+        total_cost += getCost(*n);
+        assert(occupancy[(*n)->id] >= 0);
+        removePlacedOp(opnode, *n);
+
+        if(journaling)
+            journal.push_back({opnode, *n, false});
     }
 
-    mapping[opnode].clear();
+    nodes.clear();
+}
 
+// Converts the id indexed mapping back to the form used by the Mapping object
+std::map<OpGraphNode*, std::vector<MRRGNode*>> AnnealMapper::getMapping(OpGraph* opgraph)
+{
+    std::map<OpGraphNode*, std::vector<MRRGNode*>> result;
+    for(auto & op: opgraph->op_nodes)
+    {
+        result[op] = mapping[op->id];
+    }
+    for(auto & val: opgraph->val_nodes)
+    {
+        result[val] = mapping[val->id];
+    }
     return result;
 }
 
+// Sets the path latencies of the mapped vals on the OpGraph, an II sweep does it once it has picked a mapping
+void AnnealMapper::applyOutputLatency(OpGraph* opgraph)
+{
+    if(!ii_sweep)
+        updateOpGraph(opgraph);
+}
+
+void AnnealMapper::updateOpGraph(OpGraph* opgraph)
+{
+    for(auto & val: opgraph->val_nodes)
+    {
+        val->output_latency = output_latency[val->id];
+    }
+}
+
+std::unique_ptr<Mapper> AnnealMapper::clone() const
+{
+    return std::unique_ptr<Mapper>(new AnnealMapper(*this));
+}
+
 /**
   Returns the MRRGNode that the Op is mapped to, NULL if unmapped
  **/
 MRRGNode* AnnealMapper::getMappedMRRGNode(OpGraphOp* op)
 {
-    std::vector<MRRGNode*>& mapped_nodes = mapping[op];
+    std::vector<MRRGNode*>& mapped_nodes = mapping[op->id];
     if(mapped_nodes.size() != 0)
     {
         assert(mapped_nodes.size() == 1); // Op should only be mapped to a single node
@@ -348,39 +483,30 @@ bool compare_op_cost(float penalty_factor, OpGraphOp* a, OpGraphOp* b)
     return a->getCost(penalty_factor) > b->getCost(penalty_factor);
 }
 */
-bool operator<(const std::pair<float,MRRGNode*> & a, const std::pair<float,MRRGNode*> & b)
-{
-    return a.first > b.first;
-}
-
 // Route a val node on to the MRRG, false if unable to route
-bool AnnealMapper::routeVal(OpGraphVal* val)
+bool AnnealMapper::routeVal(OpGraphVal* val, MRRG* mrrg)
 {
     assert(val);
 #ifdef DEBUG_ROUTING
     cout << "Routing val: " << *val << endl;
-    cout << "Routing from: " << *(val->input->mapped_nodes[0]) << endl;
+    cout << "Routing from: " << *(mapping[val->input->id][0]) << endl;
 #endif
     // verify that fanin and fanouts are placed
-    if(mapping[val->input].size() == 0)
+    if(mapping[val->input->id].size() == 0)
     {
 #ifdef DEBUG_ROUTING
         cout << "Routing input not mappped!" << endl;
 #endif
         return false;
     }
-    // verify fanouts placed; initialize fanout_mapped flags
-    std::map<MRRGNode*, bool> fanout_mapped;
-    std::map<MRRGNode*, unsigned int> output_number;
-
-    // TODO: is this the right place to resize this vector?
-    val->output_latency.resize(val->output.size());
 
+    // find the sinks (FU operand nodes) of the val
+    sinks.resize(val->output.size());
     for(unsigned int i = 0; i < val->output.size(); ++i)
     {
         OpGraphOp* fos = val->output[i];
 
-        if(mapping[fos].size() == 0)
+        if(mapping[fos->id].size() == 0)
         {
 #ifdef DEBUG_ROUTING
             cout << *fos << "NOT MAPPED?!?!" << endl;
@@ -389,143 +515,21 @@ bool AnnealMapper::routeVal(OpGraphVal* val)
             return false;
         }
         // TODO: this next line of code is so ugly.....
-        MRRGNode* dst = mapping[fos][0]->operand[val->output_operand[i]];
-        output_number[dst] = i;
-        fanout_mapped[dst] = false;
+        sinks[i] = mapping[fos->id][0]->operand[val->output_operand[i]];
 #ifdef DEBUG_ROUTING
-        cout << "          to: " << *(fos->mapped_nodes[0]) << ", operand = " << val->output_operand[i] << endl;
+        cout << "          to: " << *(mapping[fos->id][0]) << ", operand = " << val->output_operand[i] << endl;
 #endif
     }
 
-    std::list<MRRGNode*> src_nodes;
-    src_nodes.push_back(mapping[val->input][0]);
-
-    bool all_fanouts_mapped = false;
-    while(!all_fanouts_mapped)
+    if(!routeTree(scratch, *mrrg, astar_factor, mapping[val->input->id][0], sinks, [this](MRRGNode* n) { return getCost(n); }, route_tree, output_latency[val->id]))
     {
-        // try mapping
-        std::priority_queue<std::pair<float, MRRGNode*>, std::vector<std::pair<float, MRRGNode*>>> queue;
-        std::vector<MRRGNode*> nodes_in_queue;
-
-        for(auto s = src_nodes.begin(); s != src_nodes.end(); ++s)
-        {
-#ifdef DEBUG_ROUTING
-            cout << "queueing fanouts of src_node: " << **s << endl;
-#endif
-            for(auto n = (*s)->fanout.begin(); n != (*s)->fanout.end(); ++n)
-            {
-                // check that fanouts arent already in the src_node list
-                if(find(src_nodes.begin(), src_nodes.end(), *n) == src_nodes.end())
-                {
-                    (*n)->prev = (*s);
-                    queue.push(std::make_pair(getCost(*n), (*n)));
-                    //nodes_in_queue.push_back(*n);
-                }
-            }
-        }
-
-        // while we still have more routing options, try to route
-        bool mapped_a_node = false;
-        while(!queue.empty())
-        {
-            auto node = queue.top();
-            queue.pop();
-            //nodes_in_queue.erase(find(nodes_in_queue.begin(), nodes_in_queue.end(), node.second));
-
-            float node_cost = node.first;
-            MRRGNode* n = node.second;
 #ifdef DEBUG_ROUTING
-            cout << "queue popped: " << *n << ": " << node_cost <<  endl;
+        cout << "Routing Failed" << endl;
 #endif
-            // if n is a new sink
-            // test if n->first is in map, then test if is unmapped
-            if(fanout_mapped.find(n) != fanout_mapped.end() && !fanout_mapped[n])
-            {
-#ifdef DEBUG_ROUTING
-                cout << "Router found sink: " << *n << "." << endl;
-#endif
-                // backtrack and mark path
-                // FUTURE TODO: mark dst OpGraphOp node with path statistics: delay, cycle latency etc..
-
-                // add dst node (the node that is the FU input) to the src list.
-                src_nodes.push_back(n);
-
-                unsigned int latency = 0;
-                MRRGNode* k = n->prev;
-
-                while(find(src_nodes.begin(), src_nodes.end(), k) == src_nodes.end())
-                {
-#ifdef DEBUG_ROUTING
-                    cout << *k << endl;
-#endif
-                    //if((*k)->type == MRRG_NODE_REGISTER)
-                    //{
-                    latency += k->latency;
-                    //}
-
-                    // add node to src node list
-                    src_nodes.push_back(k);
-                    // backtrack
-                    k = k->prev;
-                }
-
-                // clear queue and unmark all backtrack paths to src_nodes
-                // inner while loop will end when queue is empty
-                while(!queue.empty())
-                {
-                    auto node_pair = queue.top();
-                    queue.pop();
-                    //nodes_in_queue.erase(find(nodes_in_queue.begin(), nodes_in_queue.end(), node_pair.second));
-
-                    MRRGNode* k = node_pair.second;
-                    // while we haven't backtracked to already removed path AND we havent reached any source nodes
-                    while(k != NULL && find(src_nodes.begin(), src_nodes.end(), k) == src_nodes.end())
-                    {
-                        MRRGNode* prev = k;
-                        k = k->prev;
-                        prev->prev = NULL;
-                    }
-                }
-
-                // we have now mapped the fanout
-                fanout_mapped[n] = true;
-                val->output_latency[output_number[n]] = latency;
-                mapped_a_node = true;
-            }
-            else
-            {
-                // queue up all fanouts
-                if(n->type == MRRG_NODE_ROUTING)
-                {
-                    for(auto i = n->fanout.begin(); i != n->fanout.end(); ++i)
-                    {
-                        // check that fanouts arent already in the src_node
-                        if(!(*i)->prev)
-                        {
-                            (*i)->prev = n;
-                            queue.push(std::make_pair(node_cost + getCost(*i), (*i)));
-                        }
-                    }
-                }
-            }
-        }
-
-        // if we exited the loop and didn't map a node, we have an unreachable route
-        if(!mapped_a_node) // if we exited the loop and didn't map a node, we have an unreachable route
-        {
-#ifdef DEBUG_ROUTING
-            cout << "Routing Failed" << endl;
-#endif
-            return false;
-        }
-        all_fanouts_mapped = true;
-        for(auto i = fanout_mapped.begin(); i != fanout_mapped.end(); ++i)
-        {
-            all_fanouts_mapped &= i->second;
-        }
+        return false;
     }
 
-    for(auto s = src_nodes.begin(); s != src_nodes.end(); ++s)
+    for(auto s = route_tree.begin(); s != route_tree.end(); ++s)
     {
         if((*s)->type == MRRG_NODE_ROUTING)
         {
@@ -535,12 +539,6 @@ bool AnnealMapper::routeVal(OpGraphVal* val)
             // map val to this node
             mapMRRGNode(val, *s);
         }
-        else
-        {
-#ifdef DEBUG_ROUTING
-            cout << "non routing node in source node list" << endl;
-#endif
-        }
     }
 
 #ifdef DEBUG_ROUTING
@@ -570,19 +568,17 @@ float AnnealMapper::getTotalOpCost(OpGraphOp* op)
     return result;
 }
 
-// Rips up Op as well as routes in and out (if they exist) and records the cost of whatever was ripped up
-// if a pointer to cost is given, the cost is also returned
-OpMapping AnnealMapper::ripUpOp(OpGraphOp* op, float* cost)
+// Rips up Op as well as routes in and out (if they exist). Inside a move, the journal records what was ripped up
+// if a pointer to cost is given, the cost of whatever was ripped up is returned
+void AnnealMapper::ripUpOp(OpGraphOp* op, float* cost)
 {
-    OpMapping result;
-
     if(cost)
     {
         *cost = 0.0;
         *cost += getCost(op);
     }
 
-    result.mapping[op] = unmapAllMRRGNodes(op);
+    unmapAllMRRGNodes(op);
 
     if(op->opcode != OPGRAPH_OP_INPUT && op->opcode != OPGRAPH_OP_CONST)
     {
@@ -592,9 +588,8 @@ OpMapping AnnealMapper::ripUpOp(OpGraphOp* op, float* cost)
             {
                 *cost += getCost(in);
             }
-            // record input val mapping, only if not already recorded. This happens when the same value feeds both operands.
-            if(result.mapping.find(in) == result.mapping.end())
-                result.mapping[in] = unmapAllMRRGNodes(in);
+            // does nothing if the same value feeds both operands and is already ripped up
+            unmapAllMRRGNodes(in);
         }
     }
 
@@ -605,28 +600,55 @@ OpMapping AnnealMapper::ripUpOp(OpGraphOp* op, float* cost)
             *cost += getCost(op->output);
         }
 
-        // record output val mapping
-        result.mapping[op->output] = unmapAllMRRGNodes(op->output);
+        unmapAllMRRGNodes(op->output);
     }
+}
 
-    return result;
+// Starts recording all mapping changes to the journal
+void AnnealMapper::beginMove()
+{
+    journal.clear();
+    journaling = true;
 }
 
-void AnnealMapper::restoreOp(OpMapping oldmap)
+// Keeps the changes made since beginMove()
+void AnnealMapper::commitMove()
 {
-    for(auto m = oldmap.mapping.begin(); m != oldmap.mapping.end(); ++m)
+    journaling = false;
+}
+
+// Undoes all changes made since beginMove() by replaying the journal backwards
+void AnnealMapper::rollbackMove()
+{
+    journaling = false;
+    for(auto e = journal.rbegin(); e != journal.rend(); ++e)
     {
-        mapAllMRRGNodes(m->first, m->second);
+        if(e->mapped)
+        {
+            // as the journal is replayed backwards, this is the last node mapped to opnode
+            std::vector<MRRGNode*>& nodes = mapping[e->opnode->id];
+            assert(!nodes.empty() && nodes.back() == e->node);
+            total_cost -= getCost(e->node);
+            occupancy[e->node->id]--;
+            total_cost += getCost(e->node);
+            removePlacedOp(e->opnode, e->node);
+            nodes.pop_back();
+        }
+        else
+        {
+            mapMRRGNode(e->opnode, e->node);
+        }
     }
+    journal.clear();
 }
 
 // get a random unoccupied  FU
 MRRGNode* AnnealMapper::getRandomUnoccupiedFU(MRRG* mrrg, OpGraphOp* op)
 {
     std::vector<MRRGNode*> candidates;
-    for(auto & fu : mrrg->function_nodes)
+    for(auto & fu : mrrg->function_nodes_by_opcode[op->opcode])
     {
-        if(fu->canMapOp(op) && occupancy[fu] == 0)
+        if(occupancy[fu->id] == 0)
         {
             candidates.push_back(fu);
         }
@@ -638,28 +660,54 @@ MRRGNode* AnnealMapper::getRandomUnoccupiedFU(MRRG* mrrg, OpGraphOp* op)
         assert(candidates.size() > 0);
     }
 
-    return candidates[rand() % candidates.size()];
+    return candidates[randInt(candidates.size())];
 }
 
-// generate a random FU
-MRRGNode* getRandomFU(MRRG* mrrg, OpGraphOp* op)
+// Picks the target FU of a move. With the range limiter on, this is a random FU that can map op
+// within range_limit routing hops of the FU op is placed on, otherwise any FU that can map op.
+MRRGNode* AnnealMapper::getCandidateFU(MRRG* mrrg, OpGraphOp* op)
 {
-    std::vector<MRRGNode*> candidates;
-    for(auto & fu : mrrg->function_nodes)
+    MRRGNode* current = getMappedMRRGNode(op);
+    if(!range_limit || !current || range_limit_dist >= max_range_limit_dist)
+        return getRandomFU(mrrg, op);
+
+    // neighbourFUs is sorted by distance
+    const std::vector<std::pair<MRRGNode*, int>>& neighbours = current->neighbourFUs;
+    auto end = std::upper_bound(neighbours.begin(), neighbours.end(), (int) range_limit_dist,
+        [](int dist, const std::pair<MRRGNode*, int>& n) { return dist < n.second; });
+
+    range_candidates.clear();
+    for(auto n = neighbours.begin(); n != end; ++n)
     {
-        if(fu->canMapOp(op))
-        {
-            candidates.push_back(fu);
-        }
+        if(n->first->canMapOp(op))
+            range_candidates.push_back(n->first);
     }
 
+    if(range_candidates.empty())
+        return getRandomFU(mrrg, op);
+
+    return range_candidates[randInt(range_candidates.size())];
+}
+
+// VPR style range limit update, the window shrinks when less than 44% of the moves are accepted
+void AnnealMapper::updateRangeLimit(float accept_rate)
+{
+    range_limit_dist = range_limit_dist * (1.0 - 0.44 + accept_rate);
+    range_limit_dist = std::max(1.0f, std::min(range_limit_dist, (float) max_range_limit_dist));
+}
+
+// generate a random FU
+MRRGNode* AnnealMapper::getRandomFU(MRRG* mrrg, OpGraphOp* op)
+{
+    const std::vector<MRRGNode*>& candidates = mrrg->function_nodes_by_opcode[op->opcode];
+
     if(candidates.size() < 1)
     {
         cout << "Could not place: " << *op << endl;
         assert(candidates.size() > 0);
     }
 
-    return candidates[rand() % candidates.size()];
+    return candidates[randInt(candidates.size())];
 }
 
 
@@ -835,7 +883,7 @@ bool AnnealMapper::placeOp(OpGraphOp* op, MRRGNode* n)
 {
     assert(n->type == MRRG_NODE_FUNCTION);
 
-    if(mapping[op].size() != 0) // Make sure this op is not placed anywhere else
+    if(mapping[op->id].size() != 0) // Make sure this op is not placed anywhere else
         return false;
 
     mapMRRGNode(op, n);
@@ -843,24 +891,44 @@ bool AnnealMapper::placeOp(OpGraphOp* op, MRRGNode* n)
     return true;
 }
 
-inline bool accept(float delta_cost, float temperature)
+// Seeds the random stream of this mapper. Every stream is reproducible from the random seed
+// and the stream number, the single chain mapper uses stream 0 and replica r uses r + 1.
+void AnnealMapper::seedRandom(int stream)
+{
+    std::seed_seq seq{rand_seed, stream};
+    rng.seed(seq);
+}
+
+// uniform random integer in [0, n)
+int AnnealMapper::randInt(int n)
+{
+    return std::uniform_int_distribution<int>(0, n - 1)(rng);
+}
+
+// uniform random number in [0, 1)
+float AnnealMapper::randFloat()
+{
+    return std::uniform_real_distribution<float>(0.0, 1.0)(rng);
+}
+
+bool AnnealMapper::accept(float delta_cost, float temperature)
 {
     if(delta_cost < 0)
         return true;
 
     float probability = exp(-(delta_cost) / temperature);
 
-    return probability > ((float) rand() / (float) RAND_MAX);
+    return probability > randFloat();
 }
 
-inline bool accept(float new_cost, float old_cost, float temperature)
+bool AnnealMapper::accept(float new_cost, float old_cost, float temperature)
 {
     if(new_cost < old_cost)
         return true;
 
     float probability = exp(-(new_cost - old_cost) / temperature);
 
-    return probability > ((float) rand() / (float) RAND_MAX);
+    return probability > randFloat();
 }
 
 inline float AnnealMapper::updateTempConst(float t)
@@ -868,7 +936,8 @@ inline float AnnealMapper::updateTempConst(float t)
     return t * const_temp_factor; //0.999;
 }
 
-float updateTemperature(float t, float acceptance_rate)
+// Adaptive schedule, cools slowly in the range of acceptance rates where the cost improves the most
+float AnnealMapper::updateTemperature(float t, float acceptance_rate)
 {
     if(acceptance_rate > 0.96)
     {
@@ -896,17 +965,11 @@ bool AnnealMapper::routeOp(OpGraphOp* op, MRRG* mrrg)
     {
         for(auto v = op->input.begin(); v != op->input.end(); ++v)
         {
-            // check all nodes and make sure prev is NULL
-            for(auto node = mrrg->function_nodes.begin(); node != mrrg->function_nodes.end(); ++node)
-                (*node)->prev = NULL;
-
-            for(auto node = mrrg->routing_nodes.begin(); node != mrrg->routing_nodes.end(); ++node)
-                (*node)->prev = NULL;
-
-            bool r = routeVal(*v);
+            bool r = routeVal(*v, mrrg);
             if(!r)
             {
-                cout << "Could not route val: \"" << **v << "\". Turn on DEBUG_ROUTING for more info." << endl;
+                if(verbose)
+                    cout << "Could not route val: \"" << **v << "\". Turn on DEBUG_ROUTING for more info." << endl;
             }
             result &= r;
         }
@@ -915,17 +978,11 @@ bool AnnealMapper::routeOp(OpGraphOp* op, MRRG* mrrg)
     // route output val
     if(op->opcode != OPGRAPH_OP_OUTPUT && op->opcode != OPGRAPH_OP_STORE)
     {
-        // check all nodes and make sure prev is NULL
-        for(auto node = mrrg->function_nodes.begin(); node != mrrg->function_nodes.end(); ++node)
-            (*node)->prev = NULL;
-
-        for(auto node = mrrg->routing_nodes.begin(); node != mrrg->routing_nodes.end(); ++node)
-            (*node)->prev = NULL;
-
-        bool r = routeVal(op->output);
+        bool r = routeVal(op->output, mrrg);
         if(!r)
         {
-            cout << "Could not route val: \"" << *(op->output) << "\". Turn on DEBUG_ROUTING for more info." << endl;
+            if(verbose)
+                cout << "Could not route val: \"" << *(op->output) << "\". Turn on DEBUG_ROUTING for more info." << endl;
         }
         result &= r;
     }
@@ -933,6 +990,34 @@ bool AnnealMapper::routeOp(OpGraphOp* op, MRRG* mrrg)
     return result;
 }
 
+// Reroutes all vals of the current placement with the negotiated congestion router.
+// On success the routing replaces the annealer's routing and true is returned.
+bool AnnealMapper::routeNegotiated(OpGraph* opgraph, MRRG* mrrg)
+{
+    std::vector<MRRGNode*> placement(opgraph->op_nodes.size());
+    for(auto & op: opgraph->op_nodes)
+    {
+        placement[op->id] = getMappedMRRGNode(op);
+    }
+
+    NegotiatedRouter router(mrrg, negotiated_router_iterations);
+    router.setVerbose(verbose);
+    bool routed = router.route(opgraph, placement);
+    if(verbose)
+        cout << "Negotiated routing " << (routed ? "succeeded" : "failed") << " after " << router.getIterations() << " iterations" << endl;
+    if(!routed)
+        return false;
+
+    for(auto & val: opgraph->val_nodes)
+    {
+        unmapAllMRRGNodes(val);
+        mapAllMRRGNodes(val, router.getRoute(val));
+        output_latency[val->id] = router.getOutputLatency(val);
+    }
+
+    return true;
+}
+
 static inline double getcurrenttime()
 {
     struct timeval t;
@@ -942,29 +1027,39 @@ static inline double getcurrenttime()
     return t.tv_sec + t.tv_usec * 0.000001;
 }
 
-// This is the main mapping function
-// true on success, false on failure
-Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II) 
+// Resets the mapping state, indexed by MRRGNode::id and OpGraphNode::id
+void AnnealMapper::resetMapping(OpGraph* opgraph, MRRG* mrrg)
 {
-    // get the mrrg object 
-    MRRG* mrrg = cgra->getMRRG(II).get();
+    occupancy.assign(mrrg->getNumNodes(), 0);
+    mapping.assign(opgraph->op_nodes.size() + opgraph->val_nodes.size(), std::vector<MRRGNode*>());
+    output_latency.assign(opgraph->op_nodes.size() + opgraph->val_nodes.size(), std::vector<unsigned int>());
+    placed_ops.assign(mrrg->function_nodes.size(), std::vector<OpGraphOp*>());
 
-    // Create result obj
-    Mapping mapping_result(cgra, II, opgraph);
+    // the range limit starts out covering the whole MRRG
+    max_range_limit_dist = 0;
+    for(auto & fu: mrrg->function_nodes)
+    {
+        if(!fu->neighbourFUs.empty())
+            max_range_limit_dist = std::max(max_range_limit_dist, fu->neighbourFUs.back().second);
+    }
+    range_limit_dist = max_range_limit_dist;
+    scratch.resize(mrrg->getNumNodes());
 
-    // Set the random seed
-    srand(this->rand_seed);
+    // Initialize the running cost from whatever is currently mapped
+    recomputeCost(mrrg);
+}
 
-#ifdef ANNEAL_DEBUG
-    ofstream anneal_debug;
-    anneal_debug.open("anneal_debug.csv");
-#endif
+// Resets the mapping state and does a random initial placement
+void AnnealMapper::initialPlacement(OpGraph* opgraph, MRRG* mrrg)
+{
+    resetMapping(opgraph, mrrg);
 
     // Sort the opgraph nodes
     // TODO: This does not work on graphs with back edges
     // topological_sort(opgraph);
 
-    cout << "Initial placement:" << endl;
+    if(verbose)
+        cout << "Initial placement:" << endl;
     // randomized initial placement
     for(auto & op: opgraph->op_nodes)
     {
@@ -973,10 +1068,17 @@ Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II)
 #else
         MRRGNode* fu = getRandomUnoccupiedFU(mrrg, op);
 #endif
-        cout << *op << " : " << *fu << endl;
+        if(verbose)
+            cout << *op << " : " << *fu << endl;
         bool routed = placeOp(op, fu );
         assert(routed);
     }
+}
+
+// Resets the mapping state and does a random initial placement and routing
+void AnnealMapper::initialPlaceAndRoute(OpGraph* opgraph, MRRG* mrrg)
+{
+    initialPlacement(opgraph, mrrg);
 
     for(auto & op: opgraph->op_nodes)
     {
@@ -987,7 +1089,7 @@ Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II)
     // Verify initial place and route
     for(auto & op: opgraph->op_nodes)
     {
-        if(mapping[op].size() == 0)
+        if(mapping[op->id].size() == 0)
         {
             cout << "No initial placement for: " << op->name << endl;
             assert(0);
@@ -996,19 +1098,26 @@ Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II)
 
     for(auto & val: opgraph->val_nodes)
     {
-        if(mapping[val].size() == 0)
+        if(mapping[val->id].size() == 0)
         {
             cout << "No initial routing for: " << val->name << endl;
             assert(0);
         }
     }
+}
 
+// Finds the temperature at which about accept_percentage of the moves from the current placement are accepted
+float AnnealMapper::initialTemperature(OpGraph* opgraph, MRRG* mrrg, float accept_percentage)
+{
 #ifdef CALCULATE_INITIAL_TEMPERATURE
     /************************* TRY TO DO 100 iterations before annealing********/
 
-    cout << "Finding delta Costs:" << endl << "INITIAL:" << endl << "OpGraph Cost: " <<  getCost(opgraph.get()) << endl;
-    cout << "MRRG Cost: " << getCost(mrrg) << endl;
-    cout << "Penalty Factor: " << pfactor << endl;
+    if(verbose)
+    {
+        cout << "Finding delta Costs:" << endl << "INITIAL:" << endl << "OpGraph Cost: " <<  getCost(opgraph) << endl;
+        cout << "MRRG Cost: " << getCost(mrrg) << endl;
+        cout << "Penalty Factor: " << pfactor << endl;
+    }
 
     float max_delta_cost = 0;
     float old_cost = getCost(mrrg);
@@ -1018,7 +1127,7 @@ Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II)
     {
         //first get a random index
         int vector_size = opgraph->op_nodes.size();
-        int index = rand() % vector_size;
+        int index = randInt(vector_size);
 
         //perturb at this index
         OpGraphOp* op = opgraph->op_nodes[index];
@@ -1029,10 +1138,11 @@ Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II)
 
         if (fu->canMapOp(op)){
             //check if occupied
-            if(occupancy[fu] == 0)
+            if(occupancy[fu->id] == 0)
             {
                 //move there
-                OpMapping oldmap = ripUpOp(op);
+                beginMove();
+                ripUpOp(op);
                 bool success = placeOp(op, fu);
                 if (success)
                     success = routeOp(op, mrrg);
@@ -1045,8 +1155,7 @@ Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II)
                     max_delta_cost = change_cost;
 
                 //restore changes
-                ripUpOp(op);
-                restoreOp(oldmap);
+                rollbackMove();
 
             }
             else
@@ -1056,14 +1165,15 @@ Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II)
 #endif
                 //swap, rip off two nodes?
                 //first find the op node corresponding to this mrrg node
-                OpGraphOp* second_op = getOpNodePtr(opgraph.get(), fu);
+                OpGraphOp* second_op = getOpNodePtr(opgraph, fu);
 
                 //keep track of op's MRRG Node
                 MRRGNode* first_MRRGNode = getMappedMRRGNode(op);
 
                 //swap these two nodes
-                OpMapping oldmap_x = ripUpOp(op);
-                OpMapping oldmap_y = ripUpOp(second_op);
+                beginMove();
+                ripUpOp(op);
+                ripUpOp(second_op);
 
                 bool success_x = placeOp(op, fu);
                 bool success_y = placeOp(second_op, first_MRRGNode);
@@ -1087,10 +1197,7 @@ Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II)
                     max_delta_cost = change_cost;
 
                 //restore the opgraph
-                ripUpOp(op);
-                ripUpOp(second_op);
-                restoreOp(oldmap_x);
-                restoreOp(oldmap_y);
+                rollbackMove();
             }
         }
         else
@@ -1101,87 +1208,862 @@ Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II)
     }
 
     //calculate initial temperature
-    float accept_percentage = 0.99;
     float natural_log = log(accept_percentage);
 
     // initial temperature
     float temperature = (-1)*max_delta_cost/(natural_log);
-    cout << " max delta cost is " << max_delta_cost <<endl;
+    if(verbose)
+        cout << " max delta cost is " << max_delta_cost <<endl;
 #else
     float temperature = 1000000.0;
 #endif
-    cout << "Initial Temperature is " << temperature <<endl;
+    if(verbose)
+        cout << "Initial Temperature is " << temperature <<endl;
 
     /************************** Done 100 iterations **************************************/
 
-    cout << "Begin annealing" << endl;
+    return temperature;
+}
+
+// This is the main mapping function
+// true on success, false on failure
+Mapping AnnealMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II) 
+{
+    if(num_replicas > 1)
+        return mapOpGraphParallel(opgraph, II);
+    if(multi_start > 1)
+        return mapOpGraphMultiStart(opgraph, II);
+
+    // get the mrrg object 
+    MRRG* mrrg = cgra->getMRRG(II).get();
+
+    // Create result obj
+    Mapping mapping_result(cgra, II, opgraph);
+
+    // the attempts of an II sweep each keep their own checkpoint
+    if(ii_sweep && !checkpoint_file.empty())
+        checkpoint_file += ".II" + std::to_string(II);
+
+    // Set the random seed
+    seedRandom(0);
+
+#ifdef ANNEAL_DEBUG
+    ofstream anneal_debug;
+    anneal_debug.open("anneal_debug.csv");
+#endif
+
     bool no_timelimit = (timelimit == 0.0);
     double start_time = getcurrenttime();
     double current_time = getcurrenttime();
 
+    float temperature;
+    float best_cost;
+    int stagnant_steps = 0;
+    int reheats = 0;
+    if(!resume_file.empty())
+    {
+        loadCheckpoint(opgraph.get(), mrrg, II, &temperature, &best_cost, &stagnant_steps, &reheats);
+        if(verbose)
+            cout << "Resumed from checkpoint: " << resume_file << endl;
+    }
+    else if(placement_only)
+    {
+        initialPlacement(opgraph.get(), mrrg);
+        if(annealPlacement(opgraph.get(), mrrg, start_time))
+        {
+            mapping_result.setMapping(getMapping(opgraph.get()));
+            applyOutputLatency(opgraph.get());
+            if(verbose)
+            {
+                cout << "MappingTime: " << (int)(getcurrenttime() - start_time) << endl;
+                cout << "MapperTimeout: 0" << endl;
+                cout << "Mapped: 1" << endl;
+            }
+            mapping_result.setMapped(true);
+            return mapping_result;
+        }
+
+        // fall back to annealing with rip-up and reroute, starting cold to refine the placement
+        if(verbose)
+            cout << "Placement could not be routed, continue annealing with routing" << endl;
+        for(auto & op: opgraph->op_nodes)
+        {
+            bool routed = routeOp(op, mrrg);
+            assert(routed);
+        }
+        temperature = initialTemperature(opgraph.get(), mrrg, FALLBACK_ACCEPT_RATE);
+    }
+    else
+    {
+        initialPlaceAndRoute(opgraph.get(), mrrg);
+        temperature = initialTemperature(opgraph.get(), mrrg);
+    }
+
+    if(verbose)
+    {
+        cout << "Begin annealing" << endl;
+        if(astar_factor > 0)
+            cout << "Routing with A* lookahead weight: " << astar_factor << endl;
+        if(!checkpoint_file.empty())
+            cout << "Writing a checkpoint every " << checkpoint_interval << " temperature steps to: " << checkpoint_file << endl;
+    }
+
     float current_cost = getCost(mrrg);
-    while(no_timelimit || (current_time - start_time) < timelimit)
+    if(resume_file.empty())
+        best_cost = current_cost;
+    int step = 0;
+    while((no_timelimit || (current_time - start_time) < timelimit) && !cancelled())
     {
         float accept_rate = 0.0;
         float previous_cost = current_cost;
-        cout << "Annealing at:" << endl;
-        cout << "\ttemp: " << temperature << endl;
-        cout << "\tpfactor: " << pfactor << endl;
+        if(verbose)
+        {
+            cout << "Annealing at:" << endl;
+            cout << "\ttemp: " << temperature << endl;
+            cout << "\tpfactor: " << pfactor << endl;
+            if(range_limit)
+                cout << "\trange limit: " << range_limit_dist << endl;
+            if(anneal_schedule == AnnealSchedule::ADAPTIVE)
+                cout << "\tstagnant steps: " << stagnant_steps << " reheats: " << reheats << endl;
+        }
         if(inner_place_and_route_loop(opgraph.get(), mrrg, temperature, &accept_rate))
         {
-            mapping_result.setMapping(mapping);
-            cout << "MappingTime: " << (int)(getcurrenttime() - start_time) << endl;
-            cout << "MapperTimeout: 0" << endl;
-            cout << "Mapped: 1" << endl;
+            mapping_result.setMapping(getMapping(opgraph.get()));
+            applyOutputLatency(opgraph.get());
+            if(verbose)
+            {
+                cout << "MappingTime: " << (int)(getcurrenttime() - start_time) << endl;
+                cout << "MapperTimeout: 0" << endl;
+                cout << "Mapped: 1" << endl;
+            }
             mapping_result.setMapped(true);
             return mapping_result;
         }
         current_cost = getCost(mrrg);
 
+        // the placement may still be legal if all vals are rerouted together
+        if(negotiated_router && routeNegotiated(opgraph.get(), mrrg))
+        {
+            mapping_result.setMapping(getMapping(opgraph.get()));
+            applyOutputLatency(opgraph.get());
+            if(verbose)
+            {
+                cout << "MappingTime: " << (int)(getcurrenttime() - start_time) << endl;
+                cout << "MapperTimeout: 0" << endl;
+                cout << "Mapped: 1" << endl;
+            }
+            mapping_result.setMapped(true);
+            return mapping_result;
+        }
+
 #ifdef ANNEAL_DEBUG
         anneal_debug << temperature <<",";
         anneal_debug << current_cost <<",";
         anneal_debug << pfactor <<",";
         anneal_debug << endl;
 #endif
-        // TODO: Changed from 0.01
-        //if(temperature  < 0.001 * mrrg->getCost(pfactor) / mrrg->routing_nodes.size())
-        if(accept_rate < cold_accept_rate && current_cost >= previous_cost)
+        // the adaptive schedule reheats when the cost has stagnated at a low acceptance rate,
+        // and gives up after max_reheats
+        bool reheated = false;
+        if(anneal_schedule == AnnealSchedule::ADAPTIVE)
         {
-#ifdef ANNEAL_DEBUG
-            anneal_debug.close();
-#endif
-            cout << "Mapper is Cold and no valid mapping was found." << endl;
-            cout << "Current Temperature acceptance rate was: " << accept_rate << endl;
-            cout << "Cold acceptance rate is: " << cold_accept_rate << endl;
-            cout << "Current Cost is: " << current_cost << endl;
-            cout << "Previous  Cost was: " << previous_cost << endl;
-            cout << "Mapped: 0" << endl;
-            return mapping_result;
-        }
-        cout << "mrrg cost: " << getCost(mrrg) << endl;
-        cout << "mrrg size: " << mrrg->routing_nodes.size() << endl;
-        cout << "update temp. & pfactor" << endl;
-        // update temperature
-#ifdef SIMPLE_ANNEAL_SCHEDULE
-        temperature = updateTempConst(temperature);
-#else
-        temperature = updateTemperature(temperature, (float)total_accepted/total_tries);
-#endif
-        // update overuse penalty
+            if(current_cost < best_cost * (1.0 - STAGNATION_TOLERANCE))
+            {
+                best_cost = current_cost;
+                stagnant_steps = 0;
+            }
+            else if(accept_rate < cold_accept_rate)
+            {
+                stagnant_steps++;
+            }
+
+            if(stagnant_steps >= stagnation_steps)
+            {
+                if(reheats >= max_reheats)
+                {
+                    if(verbose)
+                    {
+                        cout << "Mapper is Cold after " << reheats << " reheats and no valid mapping was found." << endl;
+                        cout << "Best Cost was: " << best_cost << endl;
+                        cout << "Mapped: 0" << endl;
+                    }
+                    return mapping_result;
+                }
+                reheats++;
+                stagnant_steps = 0;
+                best_cost = current_cost;
+                temperature = temperature * reheat_factor;
+                reheated = true;
+                if(verbose)
+                    cout << "Reheating to: " << temperature << endl;
+            }
+        }
+        // TODO: Changed from 0.01
+        //if(temperature  < 0.001 * mrrg->getCost(pfactor) / mrrg->routing_nodes.size())
+        else if(accept_rate < cold_accept_rate && current_cost >= previous_cost)
+        {
+#ifdef ANNEAL_DEBUG
+            anneal_debug.close();
+#endif
+            if(verbose)
+            {
+                cout << "Mapper is Cold and no valid mapping was found." << endl;
+                cout << "Current Temperature acceptance rate was: " << accept_rate << endl;
+                cout << "Cold acceptance rate is: " << cold_accept_rate << endl;
+                cout << "Current Cost is: " << current_cost << endl;
+                cout << "Previous  Cost was: " << previous_cost << endl;
+                cout << "Mapped: 0" << endl;
+            }
+            return mapping_result;
+        }
+        if(verbose)
+        {
+            cout << "mrrg cost: " << getCost(mrrg) << endl;
+            cout << "mrrg size: " << mrrg->routing_nodes.size() << endl;
+            cout << "update temp. & pfactor" << endl;
+        }
+        // update temperature
+        if(anneal_schedule == AnnealSchedule::CONSTANT)
+            temperature = updateTempConst(temperature);
+        else if(!reheated)
+            temperature = updateTemperature(temperature, accept_rate);
+        if(range_limit)
+            updateRangeLimit(accept_rate);
+        // update overuse penalty
         pfactor = pfactor * pfactor_factor;
+        // the cost function changed, so the running total has to be recomputed
+        recomputeCost(mrrg);
+
+        if(!checkpoint_file.empty() && ++step % checkpoint_interval == 0)
+            saveCheckpoint(opgraph.get(), mrrg, II, temperature, best_cost, stagnant_steps, reheats);
 
         current_time = getcurrenttime();
 
-        cout << "current run time: " << (int)(current_time -start_time)<< endl;
+        if(verbose)
+            cout << "current run time: " << (int)(current_time -start_time)<< endl;
     }
 
-    cout << "MapperTimeout: 1" << endl;
-    cout << "Mapped: 0" << endl;
+    if(verbose)
+    {
+        if(cancelled())
+            cout << "Mapping Cancelled by the II Sweep" << endl;
+        else
+            cout << "MapperTimeout: 1" << endl;
+        cout << "Mapped: 0" << endl;
+    }
 
     return mapping_result;
 }
 
+// FNV-1a hashes of the DFG and of the MRRG, so that a checkpoint is only resumed with the DFG and
+// architecture it was written for, even if another one has the same number of nodes
+static void hashString(unsigned long long & hash, const std::string & s)
+{
+    for(auto c: s)
+    {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ULL;
+    }
+    // separator, so that "ab" "c" and "a" "bc" differ
+    hash ^= 0xff;
+    hash *= 1099511628211ULL;
+}
+
+static unsigned long long getOpGraphFingerprint(OpGraph* opgraph)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for(auto & op: opgraph->op_nodes)
+    {
+        hashString(hash, op->name);
+        hashString(hash, std::to_string(op->opcode));
+    }
+    for(auto & val: opgraph->val_nodes)
+    {
+        hashString(hash, val->name);
+        hashString(hash, val->input ? val->input->name : std::string());
+        for(unsigned int i = 0; i < val->output.size(); i++)
+        {
+            hashString(hash, val->output[i]->name);
+            hashString(hash, std::to_string(val->output_operand[i]));
+        }
+    }
+    return hash;
+}
+
+static unsigned long long getMRRGFingerprint(MRRG* mrrg)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for(auto nodes: {&mrrg->function_nodes, &mrrg->routing_nodes})
+    {
+        for(auto & n: *nodes)
+        {
+            hashString(hash, n->name);
+            hashString(hash, std::to_string(n->cycle));
+            for(auto & fanout: n->fanout)
+                hashString(hash, std::to_string(fanout->id));
+        }
+    }
+    return hash;
+}
+
+// Writes the annealer state at the start of the next temperature step to checkpoint_file.
+// The state is written to a temporary file first, so a preempted job always leaves a complete checkpoint.
+// Format (text): header, sizes, DFG and MRRG fingerprints, schedule state, RNG state, then the MRRG node ids mapped to each
+// OpGraphNode and the output latencies of each val, indexed by OpGraphNode::id.
+void AnnealMapper::saveCheckpoint(OpGraph* opgraph, MRRG* mrrg, int II, float temperature, float best_cost, int stagnant_steps, int reheats)
+{
+    std::string tmp_file = checkpoint_file + ".tmp";
+    std::ofstream f(tmp_file);
+    if(!f)
+    {
+        cout << "[WARNING] Cannot write checkpoint file: " << tmp_file << endl;
+        return;
+    }
+
+    f << std::setprecision(std::numeric_limits<float>::max_digits10);
+    f << "anneal_checkpoint 2" << endl;
+    f << II << " " << mapping.size() << " " << occupancy.size() << endl;
+    f << getOpGraphFingerprint(opgraph) << " " << getMRRGFingerprint(mrrg) << endl;
+    f << temperature << " " << pfactor << " " << range_limit_dist << " " << best_cost << " " << stagnant_steps << " " << reheats << endl;
+    f << rng << endl;
+    for(auto & nodes: mapping)
+    {
+        f << nodes.size();
+        for(auto & n: nodes)
+            f << " " << n->id;
+        f << endl;
+    }
+    for(auto & latency: output_latency)
+    {
+        f << latency.size();
+        for(auto & l: latency)
+            f << " " << l;
+        f << endl;
+    }
+    f.close();
+
+    if(!f || std::rename(tmp_file.c_str(), checkpoint_file.c_str()) != 0)
+        cout << "[WARNING] Cannot write checkpoint file: " << checkpoint_file << endl;
+}
+
+// Restores the annealer state written by saveCheckpoint() from resume_file.
+// The checkpoint must come from the same architecture, DFG and II, and place every op on a function node that supports it.
+void AnnealMapper::loadCheckpoint(OpGraph* opgraph, MRRG* mrrg, int II, float* temperature, float* best_cost, int* stagnant_steps, int* reheats)
+{
+    std::ifstream f(resume_file);
+    if(!f)
+        throw cgrame_error("AnnealMapper Exception: cannot open checkpoint file \"" + resume_file + "\"");
+
+    std::string header;
+    int version, checkpoint_II;
+    unsigned int num_opgraph_nodes, num_mrrg_nodes;
+    unsigned long long opgraph_fingerprint, mrrg_fingerprint;
+    f >> header >> version >> checkpoint_II >> num_opgraph_nodes >> num_mrrg_nodes >> opgraph_fingerprint >> mrrg_fingerprint;
+    if(!f || header != "anneal_checkpoint" || version != 2)
+        throw cgrame_error("AnnealMapper Exception: \"" + resume_file + "\" is not an annealer checkpoint");
+    if(checkpoint_II != II
+        || num_opgraph_nodes != opgraph->op_nodes.size() + opgraph->val_nodes.size()
+        || num_mrrg_nodes != mrrg->getNumNodes()
+        || opgraph_fingerprint != getOpGraphFingerprint(opgraph)
+        || mrrg_fingerprint != getMRRGFingerprint(mrrg))
+        throw cgrame_error("AnnealMapper Exception: checkpoint \"" + resume_file + "\" does not match the DFG, architecture or II");
+
+    // pfactor is restored first, the running cost depends on it
+    f >> *temperature >> pfactor >> range_limit_dist >> *best_cost >> *stagnant_steps >> *reheats;
+    f >> rng;
+
+    // seeds the scratch arrays and the range limit bound, the mapping is then replayed
+    float checkpoint_range_limit_dist = range_limit_dist;
+    resetMapping(opgraph, mrrg);
+    range_limit_dist = checkpoint_range_limit_dist;
+
+    // ops only on function nodes that support them, vals only on routing nodes
+    std::vector<OpGraphNode*> opgraph_nodes(num_opgraph_nodes);
+    std::vector<OpGraphOp*> ops(num_opgraph_nodes, NULL);
+    for(auto & op: opgraph->op_nodes)
+        opgraph_nodes[op->id] = ops[op->id] = op;
+    for(auto & val: opgraph->val_nodes)
+        opgraph_nodes[val->id] = val;
+
+    for(auto & opnode: opgraph_nodes)
+    {
+        OpGraphOp* op = ops[opnode->id];
+        unsigned int count, id;
+        f >> count;
+        for(unsigned int i = 0; f && i < count; i++)
+        {
+            f >> id;
+            if(!f || id >= num_mrrg_nodes || (op != NULL) != (id < mrrg->function_nodes.size()))
+                throw cgrame_error("AnnealMapper Exception: checkpoint \"" + resume_file + "\" is truncated or corrupt");
+            MRRGNode* n = op ? mrrg->function_nodes[id] : mrrg->routing_nodes[id - mrrg->function_nodes.size()];
+            if(op && !n->canMapOp(op))
+                throw cgrame_error("AnnealMapper Exception: checkpoint \"" + resume_file + "\" places " + op->name + " on " + n->name + ", which does not support it");
+            mapMRRGNode(opnode, n);
+        }
+    }
+    for(auto & latency: output_latency)
+    {
+        unsigned int count;
+        f >> count;
+        latency.resize(f ? count : 0);
+        for(auto & l: latency)
+            f >> l;
+    }
+
+    if(!f)
+        throw cgrame_error("AnnealMapper Exception: checkpoint \"" + resume_file + "\" is truncated or corrupt");
+
+    recomputeCost(mrrg);
+}
+
+// Creates a quiet copy of this mapper with its own random stream, that stops when stop is set
+std::unique_ptr<AnnealMapper> AnnealMapper::makeReplica(int stream, const std::atomic<bool>* stop)
+{
+    std::unique_ptr<AnnealMapper> replica(new AnnealMapper(*this));
+    replica->num_replicas = 1;
+    replica->multi_start = 1;
+    replica->verbose = false;
+    replica->stop_flag = stop;
+    replica->seedRandom(stream);
+
+    return replica;
+}
+
+// One temperature step of a replica. Returns true if a legal mapping was found,
+// otherwise the temperature, range limit and penalty factor are updated for the next step.
+bool AnnealMapper::annealStep(OpGraph* opgraph, MRRG* mrrg, float* temperature, float* accept_rate, AnnealSchedule schedule)
+{
+    if(inner_place_and_route_loop(opgraph, mrrg, *temperature, accept_rate)
+        || (negotiated_router && routeNegotiated(opgraph, mrrg)))
+        return true;
+
+    if(schedule == AnnealSchedule::CONSTANT)
+        *temperature = updateTempConst(*temperature);
+    else
+        *temperature = updateTemperature(*temperature, *accept_rate);
+    if(range_limit)
+        updateRangeLimit(*accept_rate);
+    pfactor = pfactor * pfactor_factor;
+    recomputeCost(mrrg);
+
+    return false;
+}
+
+// Multi-start: multi_start independent anneals from different random placements run in parallel.
+// Every abandon_interval temperature steps, runs whose cost is more than abandon_margin worse than
+// the best run are abandoned, as are runs that have gone cold. The first legal mapping is returned.
+Mapping AnnealMapper::mapOpGraphMultiStart(std::shared_ptr<OpGraph> opgraph, int II)
+{
+    // the MRRG is created (and finalized) here, the runs only read it
+    MRRG* mrrg = cgra->getMRRG(II).get();
+
+    Mapping mapping_result(cgra, II, opgraph);
+
+    std::atomic<bool> found(false);
+    std::vector<std::unique_ptr<AnnealMapper>> runs;
+    std::vector<float> temperature(multi_start);
+    for(int r = 0; r < multi_start; r++)
+    {
+        runs.push_back(makeReplica(r + 1, &found));
+        runs[r]->initialPlaceAndRoute(opgraph.get(), mrrg);
+        temperature[r] = runs[r]->initialTemperature(opgraph.get(), mrrg);
+    }
+
+    if(verbose)
+        cout << "Begin annealing with " << multi_start << " starts" << endl;
+    bool no_timelimit = (timelimit == 0.0);
+    double start_time = getcurrenttime();
+
+    std::vector<float> accept_rate(multi_start);
+    std::vector<float> previous_cost(multi_start);
+    std::vector<char> mapped(multi_start, 0);
+    std::vector<char> alive(multi_start, 1);
+    int num_alive = multi_start;
+    for(int round = 0; num_alive > 0 && (no_timelimit || (getcurrenttime() - start_time) < timelimit) && !cancelled(); round++)
+    {
+        std::vector<std::thread> threads;
+        for(int r = 0; r < multi_start; r++)
+        {
+            if(!alive[r])
+                continue;
+
+            threads.emplace_back([&, r]()
+            {
+                AnnealMapper& run = *runs[r];
+                for(int step = 0; step < abandon_interval && !found && !cancelled(); step++)
+                {
+                    previous_cost[r] = run.getCost(mrrg);
+                    if(run.annealStep(opgraph.get(), mrrg, &temperature[r], &accept_rate[r], run.anneal_schedule))
+                    {
+                        mapped[r] = 1;
+                        found = true;
+                        return;
+                    }
+                }
+            });
+        }
+        for(auto & t: threads)
+        {
+            t.join();
+        }
+
+        for(int r = 0; r < multi_start; r++)
+        {
+            if(mapped[r])
+            {
+                mapping_result.setMapping(runs[r]->getMapping(opgraph.get()));
+                output_latency = runs[r]->output_latency;
+                applyOutputLatency(opgraph.get());
+                if(verbose)
+                {
+                    cout << "Start " << r << " found a mapping" << endl;
+                    cout << "MappingTime: " << (int)(getcurrenttime() - start_time) << endl;
+                    cout << "MapperTimeout: 0" << endl;
+                    cout << "Mapped: 1" << endl;
+                }
+                mapping_result.setMapped(true);
+                return mapping_result;
+            }
+        }
+
+        float best_cost = INFINITY;
+        for(int r = 0; r < multi_start; r++)
+        {
+            if(alive[r])
+                best_cost = std::min(best_cost, runs[r]->getCost(mrrg));
+        }
+
+        if(verbose)
+            cout << "Round " << round << ":" << endl;
+        for(int r = 0; r < multi_start; r++)
+        {
+            if(!alive[r])
+                continue;
+
+            float cost = runs[r]->getCost(mrrg);
+            if(verbose)
+                cout << "\tstart " << r << " temp: " << temperature[r] << " mrrg cost: " << cost << " accept rate: " << accept_rate[r] << endl;
+
+            if(accept_rate[r] < cold_accept_rate && cost >= previous_cost[r])
+            {
+                if(verbose)
+                    cout << "\tstart " << r << " is cold, abandoned" << endl;
+                alive[r] = 0;
+                num_alive--;
+            }
+            else if(cost > best_cost * (1.0 + abandon_margin))
+            {
+                if(verbose)
+                    cout << "\tstart " << r << " is losing, abandoned" << endl;
+                alive[r] = 0;
+                num_alive--;
+            }
+        }
+    }
+
+    if(num_alive == 0)
+    {
+        if(verbose)
+        {
+            cout << "All starts are abandoned and no valid mapping was found." << endl;
+            cout << "Mapped: 0" << endl;
+        }
+        return mapping_result;
+    }
+
+    if(verbose)
+    {
+        if(cancelled())
+            cout << "Mapping Cancelled by the II Sweep" << endl;
+        else
+            cout << "MapperTimeout: 1" << endl;
+        cout << "Mapped: 0" << endl;
+    }
+
+    return mapping_result;
+}
+
+// Parallel tempering: num_replicas copies of this mapper anneal the OpGraph on a ladder of
+// temperatures, each in its own thread with its own mapping state over the shared MRRG.
+// Every exchange_interval temperature steps, replicas at neighbouring temperatures may swap.
+Mapping AnnealMapper::mapOpGraphParallel(std::shared_ptr<OpGraph> opgraph, int II)
+{
+    // the MRRG is created (and finalized) here, the replicas only read it
+    MRRG* mrrg = cgra->getMRRG(II).get();
+
+    Mapping mapping_result(cgra, II, opgraph);
+
+    // random stream for replica exchange
+    seedRandom(0);
+
+    std::atomic<bool> found(false);
+    std::vector<std::unique_ptr<AnnealMapper>> replicas;
+    for(int r = 0; r < num_replicas; r++)
+    {
+        replicas.push_back(makeReplica(r + 1, &found));
+        replicas[r]->initialPlaceAndRoute(opgraph.get(), mrrg);
+    }
+
+    // geometric temperature ladder, replica 0 is the hottest
+    std::vector<float> temperature(num_replicas);
+    float initial_temperature = replicas[0]->initialTemperature(opgraph.get(), mrrg);
+    for(int r = 0; r < num_replicas; r++)
+    {
+        temperature[r] = initial_temperature * pow(REPLICA_TEMPERATURE_SPAN, -(float) r / (num_replicas - 1));
+    }
+
+    if(verbose)
+        cout << "Begin annealing with " << num_replicas << " replicas" << endl;
+    bool no_timelimit = (timelimit == 0.0);
+    double start_time = getcurrenttime();
+
+    std::vector<float> accept_rate(num_replicas);
+    std::vector<float> previous_cost(num_replicas);
+    std::vector<char> mapped(num_replicas, 0);
+    for(int round = 0; (no_timelimit || (getcurrenttime() - start_time) < timelimit) && !cancelled(); round++)
+    {
+        std::vector<std::thread> threads;
+        for(int r = 0; r < num_replicas; r++)
+        {
+            previous_cost[r] = replicas[r]->getCost(mrrg);
+            threads.emplace_back([&, r]()
+            {
+                AnnealMapper& replica = *replicas[r];
+                for(int step = 0; step < exchange_interval && !found && !cancelled(); step++)
+                {
+                    // the ladder is cooled with the constant schedule to keep its ordering
+                    if(replica.annealStep(opgraph.get(), mrrg, &temperature[r], &accept_rate[r], AnnealSchedule::CONSTANT))
+                    {
+                        mapped[r] = 1;
+                        found = true;
+                        return;
+                    }
+                }
+            });
+        }
+        for(auto & t: threads)
+        {
+            t.join();
+        }
+
+        for(int r = 0; r < num_replicas; r++)
+        {
+            if(mapped[r])
+            {
+                mapping_result.setMapping(replicas[r]->getMapping(opgraph.get()));
+                output_latency = replicas[r]->output_latency;
+                applyOutputLatency(opgraph.get());
+                if(verbose)
+                {
+                    cout << "Replica at temperature " << temperature[r] << " found a mapping" << endl;
+                    cout << "MappingTime: " << (int)(getcurrenttime() - start_time) << endl;
+                    cout << "MapperTimeout: 0" << endl;
+                    cout << "Mapped: 1" << endl;
+                }
+                mapping_result.setMapped(true);
+                return mapping_result;
+            }
+        }
+
+        if(verbose)
+        {
+            cout << "Round " << round << ":" << endl;
+            for(int r = 0; r < num_replicas; r++)
+            {
+                cout << "\ttemp: " << temperature[r] << " mrrg cost: " << replicas[r]->getCost(mrrg) << " accept rate: " << accept_rate[r] << endl;
+            }
+        }
+
+        // the hottest replica is cold, so all of them are
+        if(accept_rate[0] < cold_accept_rate && replicas[0]->getCost(mrrg) >= previous_cost[0])
+        {
+            if(verbose)
+            {
+                cout << "Mapper is Cold and no valid mapping was found." << endl;
+                cout << "Mapped: 0" << endl;
+            }
+            return mapping_result;
+        }
+
+        // exchange the states of neighbouring replicas, alternating between even and odd pairs.
+        // a hotter replica with a lower cost always moves down the ladder
+        for(int r = round % 2; r + 1 < num_replicas; r += 2)
+        {
+            float delta = (1.0 / temperature[r] - 1.0 / temperature[r + 1]) * (replicas[r]->getCost(mrrg) - replicas[r + 1]->getCost(mrrg));
+            if(delta >= 0 || exp(delta) > randFloat())
+            {
+                std::swap(replicas[r], replicas[r + 1]);
+            }
+        }
+    }
+
+    if(verbose)
+    {
+        if(cancelled())
+            cout << "Mapping Cancelled by the II Sweep" << endl;
+        else
+            cout << "MapperTimeout: 1" << endl;
+        cout << "Mapped: 0" << endl;
+    }
+
+    return mapping_result;
+}
+
+// Estimated cost of routing val to its i-th output: the lookahead distance between the placed FUs
+float AnnealMapper::getEdgeEstimate(MRRG* mrrg, OpGraphVal* val, unsigned int i)
+{
+    MRRGNode* src = mapping[val->input->id][0];
+    MRRGNode* sink = mapping[val->output[i]->id][0]->operand[val->output_operand[i]];
+
+    unsigned short dist = mrrg->getLookahead(src, sink);
+    return dist == MRRG::LOOKAHEAD_UNREACHABLE ? UNREACHABLE_EDGE_COST : dist;
+}
+
+// Estimated routing cost of all edges to and from op, except for the edges to and from other
+float AnnealMapper::getOpEstimate(MRRG* mrrg, OpGraphOp* op, OpGraphOp* other)
+{
+    float result = 0.0;
+
+    if(op->opcode != OPGRAPH_OP_INPUT && op->opcode != OPGRAPH_OP_CONST)
+    {
+        for(auto & in: op->input)
+        {
+            // edges from op to itself are counted with the output
+            if(in->input == op || in->input == other)
+                continue;
+
+            for(unsigned int i = 0; i < in->output.size(); ++i)
+            {
+                if(in->output[i] == op)
+                    result += getEdgeEstimate(mrrg, in, i);
+            }
+        }
+    }
+
+    if(op->opcode != OPGRAPH_OP_OUTPUT && op->opcode != OPGRAPH_OP_STORE)
+    {
+        for(unsigned int i = 0; i < op->output->output.size(); ++i)
+        {
+            if(op->output->output[i] != other)
+                result += getEdgeEstimate(mrrg, op->output, i);
+        }
+    }
+
+    return result;
+}
+
+// FU cost plus the routing estimate of every edge
+float AnnealMapper::getPlacementCost(OpGraph* opgraph, MRRG* mrrg)
+{
+    float result = getCost(mrrg);
+    for(auto & val: opgraph->val_nodes)
+    {
+        for(unsigned int i = 0; i < val->output.size(); ++i)
+            result += getEdgeEstimate(mrrg, val, i);
+    }
+
+    return result;
+}
+
+// Moves op to fu, swapping with an op already there, and accepts or rejects the move against
+// the FU cost plus the routing estimate. Returns the cost change, the move is always undone if undo is set.
+float AnnealMapper::placementMove(OpGraph* opgraph, MRRG* mrrg, OpGraphOp* op, MRRGNode* fu, float temperature, bool* accepted, bool undo)
+{
+    OpGraphOp* second_op = occupancy[fu->id] == 0 ? NULL : getOpNodePtr(opgraph, fu);
+    MRRGNode* first_fu = getMappedMRRGNode(op);
+
+    float old_cost = getCost(mrrg) + getOpEstimate(mrrg, op, NULL) + (second_op ? getOpEstimate(mrrg, second_op, op) : 0.0);
+
+    beginMove();
+    unmapAllMRRGNodes(op);
+    placeOp(op, fu);
+    if(second_op)
+    {
+        unmapAllMRRGNodes(second_op);
+        placeOp(second_op, first_fu);
+    }
+
+    float new_cost = getCost(mrrg) + getOpEstimate(mrrg, op, NULL) + (second_op ? getOpEstimate(mrrg, second_op, op) : 0.0);
+    float delta_cost = new_cost - old_cost;
+
+    bool accept_move = !undo && accept(delta_cost, temperature);
+    if(accept_move)
+        commitMove();
+    else
+        rollbackMove();
+
+    if(accepted)
+        *accepted = accept_move;
+    return delta_cost;
+}
+
+// Anneals the placement only, without routing. The negotiated router is run every route_interval
+// temperature steps and once the placement has converged. Returns true if it found a legal routing,
+// false if the placement converged without one or the time ran out.
+bool AnnealMapper::annealPlacement(OpGraph* opgraph, MRRG* mrrg, double start_time)
+{
+    // initial temperature from 100 random moves
+    float max_delta_cost = 0.0;
+    for(int i = 0; i < 100; i++)
+    {
+        OpGraphOp* op = opgraph->op_nodes[randInt(opgraph->op_nodes.size())];
+        MRRGNode* fu = getRandomFU(mrrg, op);
+        if(fu != getMappedMRRGNode(op))
+            max_delta_cost = std::max(max_delta_cost, std::abs(placementMove(opgraph, mrrg, op, fu, 0.0, NULL, true)));
+    }
+    float temperature = -max_delta_cost / log(0.99);
+
+    if(verbose)
+        cout << "Begin placement annealing at temperature " << temperature << endl;
+    bool no_timelimit = (timelimit == 0.0);
+    int num_moves = opgraph->op_nodes.size() * swap_factor;
+    float current_cost = getPlacementCost(opgraph, mrrg);
+    for(int step = 1; (no_timelimit || (getcurrenttime() - start_time) < timelimit) && !cancelled(); step++)
+    {
+        int total_accepted = 0;
+        int total_tries = 0;
+        for(int i = 0; i < num_moves; i++)
+        {
+            OpGraphOp* op = opgraph->op_nodes[randInt(opgraph->op_nodes.size())];
+            MRRGNode* fu = getCandidateFU(mrrg, op);
+            if(fu == getMappedMRRGNode(op))
+                continue;
+
+            bool accepted;
+            placementMove(opgraph, mrrg, op, fu, temperature, &accepted);
+            total_tries++;
+            total_accepted += accepted;
+        }
+        float accept_rate = total_tries ? (float) total_accepted / total_tries : 0.0;
+
+        float previous_cost = current_cost;
+        current_cost = getPlacementCost(opgraph, mrrg);
+
+        bool converged = accept_rate < cold_accept_rate && current_cost >= previous_cost;
+        if(verbose)
+            cout << "Placement at temp: " << temperature << " cost: " << current_cost << " accept rate: " << accept_rate << endl;
+
+        if(converged || step % route_interval == 0)
+        {
+            if(routeNegotiated(opgraph, mrrg))
+                return true;
+            if(converged)
+                return false;
+        }
+
+        if(anneal_schedule == AnnealSchedule::CONSTANT)
+            temperature = updateTempConst(temperature);
+        else
+            temperature = updateTemperature(temperature, accept_rate);
+        if(range_limit)
+            updateRangeLimit(accept_rate);
+        pfactor = pfactor * pfactor_factor;
+        recomputeCost(mrrg);
+    }
+
+    return false;
+}
+
 bool AnnealMapper::inner_place_and_route_loop(OpGraph* opgraph, MRRG* mrrg, float temperature, float* accept_rate)
 {
     int num_swaps = opgraph->op_nodes.size() * swap_factor;
@@ -1190,11 +2072,15 @@ bool AnnealMapper::inner_place_and_route_loop(OpGraph* opgraph, MRRG* mrrg, floa
 
     for(int i = 0; i < num_swaps; i++)
     {
+        // another replica found a mapping, or the II sweep cancelled this attempt
+        if((stop_flag && *stop_flag) || cancelled())
+            break;
+
         // Get an op
-        OpGraphOp* op = opgraph->op_nodes[rand() % opgraph->op_nodes.size()];
+        OpGraphOp* op = opgraph->op_nodes[randInt(opgraph->op_nodes.size())];
 
         // Get an fu
-        MRRGNode* fu = getRandomFU(mrrg, op);
+        MRRGNode* fu = getCandidateFU(mrrg, op);
         // make sure that it is a different FU
         if(fu == getMappedMRRGNode(op))
             continue;
@@ -1208,10 +2094,11 @@ bool AnnealMapper::inner_place_and_route_loop(OpGraph* opgraph, MRRG* mrrg, floa
             total_tries++;
 
             //check if occupied
-            if(occupancy[fu] == 0)
+            if(occupancy[fu->id] == 0)
             {
                 //move there
-                OpMapping oldmap = ripUpOp(op);
+                beginMove();
+                ripUpOp(op);
                 bool success = placeOp(op, fu);
                 if(!success)
                 {
@@ -1236,12 +2123,12 @@ bool AnnealMapper::inner_place_and_route_loop(OpGraph* opgraph, MRRG* mrrg, floa
                 if(accept(delta_cost, temperature))
                 {
                     total_accepted++;
+                    commitMove();
                 }
                 else
                 {
                     //restore changes
-                    ripUpOp(op);
-                    restoreOp(oldmap);
+                    rollbackMove();
                 }
             }
             else // there must only be one unit mapped here
@@ -1258,8 +2145,9 @@ bool AnnealMapper::inner_place_and_route_loop(OpGraph* opgraph, MRRG* mrrg, floa
                 MRRGNode* first_MRRGNode = getMappedMRRGNode(op);
 
                 //swap these two nodes
-                OpMapping oldmap_x = ripUpOp(op);
-                OpMapping oldmap_y = ripUpOp(second_op);
+                beginMove();
+                ripUpOp(op);
+                ripUpOp(second_op);
 
                 bool success_x = placeOp(op, fu);
                 bool success_y = placeOp(second_op, first_MRRGNode);
@@ -1282,13 +2170,11 @@ bool AnnealMapper::inner_place_and_route_loop(OpGraph* opgraph, MRRG* mrrg, floa
                 if(accept(delta_cost, temperature))
                 {
                     total_accepted++;
+                    commitMove();
                 }
                 else //restore the opgraph
                 {
-                    ripUpOp(op);
-                    ripUpOp(second_op);
-                    restoreOp(oldmap_x);
-                    restoreOp(oldmap_y);
+                    rollbackMove();
                 }
             }
         }
@@ -1297,25 +2183,32 @@ bool AnnealMapper::inner_place_and_route_loop(OpGraph* opgraph, MRRG* mrrg, floa
     bool mrrg_overuse = checkOveruse(mrrg);
     float opgraph_cost  = getCost(opgraph);
 
-    if(!mrrg_overuse)
+    if(verbose)
     {
-        cout << "MRRG OVERUSED!" << endl;
-    }
-    else
-    {
-        cout << "MRRG NOT OVERUSED!" << endl;
+        if(!mrrg_overuse)
+        {
+            cout << "MRRG OVERUSED!" << endl;
+        }
+        else
+        {
+            cout << "MRRG NOT OVERUSED!" << endl;
+        }
     }
 
     if(mrrg_overuse && opgraph_cost < INFINITY)
     {
-        cout << "mrrg cost: " << getCost(mrrg) << endl;
-        cout << "mrrg size: " << mrrg->routing_nodes.size() << endl;
-        cout << "temp: " << temperature << endl;
-        cout << "pfactor: " << pfactor << endl;
-        *accept_rate = (float) total_accepted / (float) total_tries;
+        if(verbose)
+        {
+            cout << "mrrg cost: " << getCost(mrrg) << endl;
+            cout << "mrrg size: " << mrrg->routing_nodes.size() << endl;
+            cout << "temp: " << temperature << endl;
+            cout << "pfactor: " << pfactor << endl;
+        }
+        *accept_rate = total_tries ? (float) total_accepted / total_tries : 0.0;
         return true;
     }
-    *accept_rate = (float) total_accepted / (float) total_tries;
+    // no move is tried if the loop is stopped early or every candidate is the FU the op is already on
+    *accept_rate = total_tries ? (float) total_accepted / total_tries : 0.0;
     return false;
 }
 
@@ -31,6 +31,11 @@
  ******************************************************************************/
 
 #include <algorithm>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <tuple>
+#include <mutex>
 
 #include <assert.h>
 
@@ -38,6 +43,8 @@
 #include <CGRA/CGRA.h>
 #include <CGRA/OpGraph.h>
 #include <CGRA/ILPMapper.h>
+#include <CGRA/AnnealMapper.h>
+#include <CGRA/Router.h>
 
 #ifdef USE_GUROBI
 #include <gurobi_c++.h>
@@ -47,8 +54,28 @@
 #include <scip/scip.h>
 #include <scip/scipdefplugins.h>
 
+// Variable and constraint names are only needed to read the exported problem
+#ifdef WRITE_PROB
+#define ILP_NAME(name) (name)
+#else
+#define ILP_NAME(name) std::string()
+#endif
+
+// SCIP 4 is only thread safe when built with PARASCIP=true, which thirdparty/scipoptsuite does not use,
+// so the attempts of an II sweep solve their SCIP models one at a time. Gurobi is safe with an
+// environment per thread, which each solve creates for itself.
+static std::mutex scip_lock;
+
+// Architecture templates by II, shared by a mapper and the copies of it that map the IIs of a sweep
+struct ILPArchTemplateCache
+{
+    std::mutex lock;
+    std::map<int, std::shared_ptr<ILPArchTemplate>> templates;
+};
+
 ILPMapper::ILPMapper(std::shared_ptr<CGRA> cgra, int timelimit, const std::map<std::string, std::string> & args)
     : Mapper(cgra, timelimit)
+    , arch_templates(std::make_shared<ILPArchTemplateCache>())
 {
 #ifdef USE_GUROBI
     auto ilp_solver_it =args.find("ILPMapper.ilp_solver");
@@ -82,6 +109,18 @@ ILPMapper::ILPMapper(std::shared_ptr<CGRA> cgra, int timelimit, const std::map<s
 #endif
     try
     {
+        warm_start = std::stoi(args.at("ILPMapper.warm_start"));
+        warm_start_timelimit = std::stod(args.at("ILPMapper.warm_start_timelimit"));
+        // the AnnealMapper parameters for the warm start
+        warm_start_args = args;
+        symmetry_breaking = std::stoi(args.at("ILPMapper.symmetry_breaking"));
+        lazy_routing = std::stoi(args.at("ILPMapper.lazy_routing"));
+        decomposed = std::stoi(args.at("ILPMapper.decomposed"));
+        decomposed_max_distance = std::stoi(args.at("ILPMapper.decomposed_max_distance"));
+        decomposed_router_iterations = std::stoi(args.at("ILPMapper.decomposed_router_iterations"));
+        if(decomposed && warm_start)
+            std::cout << "[WARNING] The Decomposed ILP Mapper Does Not Use a Warm Start, Ignoring ILPMapper.warm_start" << std::endl;
+
         switch(solvertype)
         {
             case ILPSolverType::SCIP:
@@ -112,393 +151,1093 @@ ILPMapper::ILPMapper(CGRA* cgra, int timelimit, double mipgap, int solnlimit)
 }
 */
 
+// Checks whether rotating every node by one context maps the MRRG onto itself, with the same node types,
+// supported ops, capacities and connections (in order, as fanin order is the operand order). If so, any
+// mapping can be rotated to any context, and rotation holds the next context of each node by MRRGNode::id.
+static bool getContextRotation(MRRG * mrrg, std::vector<MRRGNode*> & rotation)
+{
+    if(mrrg->II < 2)
+        return false;
+
+    rotation.assign(mrrg->getNumNodes(), nullptr);
+    for(unsigned int c = 0; c < mrrg->II; c++)
+    {
+        const std::map<std::string, MRRGNode*> & next_context = mrrg->nodes[(c + 1) % mrrg->II];
+        if(mrrg->nodes[c].size() != next_context.size())
+            return false;
+        for(auto & named_node : mrrg->nodes[c])
+        {
+            MRRGNode* n = named_node.second;
+            auto it = next_context.find(named_node.first);
+            if(it == next_context.end())
+                return false;
+            MRRGNode* next = it->second;
+            if(next->type != n->type || next->supported_ops_mask != n->supported_ops_mask || next->capacity != n->capacity
+                || next->fanin.size() != n->fanin.size() || next->fanout.size() != n->fanout.size())
+                return false;
+            rotation[n->id] = next;
+        }
+    }
+
+    for(auto & nodes : {&mrrg->function_nodes, &mrrg->routing_nodes})
+    {
+        for(auto & n : *nodes)
+        {
+            MRRGNode* next = rotation[n->id];
+            for(unsigned int i = 0; i < n->fanin.size(); i++)
+            {
+                if(rotation[n->fanin[i]->id] != next->fanin[i])
+                    return false;
+            }
+            for(unsigned int i = 0; i < n->fanout.size(); i++)
+            {
+                if(rotation[n->fanout[i]->id] != next->fanout[i])
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// The architecture side of the ILP model, everything that only depends on the MRRG. The solver problem itself
+// can not be shared between DFGs, as its rows are sums over the variables of the DFG, so this holds the
+// MRRG analysis that the constraints are built from. Built once per II by ILPMapper::getArchTemplate().
+struct ILPArchTemplate
+{
+    MRRG* mrrg;
+    // the output node of each function node, indexed by MRRGNode::id (Constraint 5)
+    std::vector<MRRGNode*> fu_output;
+    // set for the nodes that are the output of a function node
+    std::vector<char> is_fu_output;
+    // routing nodes with more than one fanin, each fanin only drives the MUX (MUX Exclusivity)
+    std::vector<MRRGNode*> mux_nodes;
+    // routing fanouts, and (function node, operand) fanouts of each routing node (Constraint 4)
+    std::vector<std::vector<MRRGNode*>> routing_fanouts;
+    std::vector<std::vector<std::pair<MRRGNode*, unsigned int>>> operand_fanouts;
+    // set if the MRRG is the same in every context, rotation is then the next context of each node
+    bool context_symmetric;
+    std::vector<MRRGNode*> rotation;
+};
+
+static std::shared_ptr<ILPArchTemplate> buildArchTemplate(MRRG * mrrg)
+{
+    auto arch = std::make_shared<ILPArchTemplate>();
+    const unsigned int num_nodes = mrrg->getNumNodes();
+
+    arch->mrrg = mrrg;
+    arch->fu_output.assign(num_nodes, nullptr);
+    arch->is_fu_output.assign(num_nodes, 0);
+    for(auto & f : mrrg->function_nodes)
+    {
+        // XXX: this assumes single output nodes in the MRRG
+        assert(f->fanout.size() == 1);
+        arch->fu_output[f->id] = f->fanout[0];
+        arch->is_fu_output[f->fanout[0]->id] = 1;
+    }
+
+    arch->routing_fanouts.assign(num_nodes, std::vector<MRRGNode*>());
+    arch->operand_fanouts.assign(num_nodes, std::vector<std::pair<MRRGNode*, unsigned int>>());
+    for(auto & r : mrrg->routing_nodes)
+    {
+        for(auto & fanout : r->fanout)
+        {
+            if(fanout->type == MRRG_NODE_ROUTING)
+            {
+                arch->routing_fanouts[r->id].push_back(fanout);
+            }
+            else if(fanout->type == MRRG_NODE_FUNCTION)
+            {
+                for(unsigned int operand = 0; operand < fanout->fanin.size(); operand++)
+                {
+                    if(fanout->fanin[operand] == r)
+                        arch->operand_fanouts[r->id].push_back(std::make_pair(fanout, operand));
+                }
+            }
+            else
+            {
+                assert(0);
+            }
+        }
+
+        if(r->fanin.size() > 1)
+        {
+            for(auto & fanin : r->fanin)
+            {
+                assert(fanin->type == MRRG_NODE_ROUTING);
+                if(fanin->fanout.size() != 1)
+                {
+                    std::cout << "Candidate MUX node is: " << *r << std::endl;
+
+                    for(auto &print_fanins : r->fanin)
+                        std::cout << *print_fanins << "->" << *r << std::endl;
+
+                    std::cout << "Problem fanin is: " << *fanin << std::endl;
+
+                    for(auto &print_fanouts : fanin->fanout)
+                        std::cout << *fanin << "->" << *print_fanouts << std::endl;
+                }
+                assert(fanin->fanout.size() == 1);
+            }
+            arch->mux_nodes.push_back(r);
+        }
+    }
+
+    arch->context_symmetric = getContextRotation(mrrg, arch->rotation);
+
+    return arch;
+}
+
+std::shared_ptr<ILPArchTemplate> ILPMapper::getArchTemplate(int II)
+{
+    MRRG* mrrg = cgra->getMRRG(II).get();
+    {
+        std::lock_guard<std::mutex> guard(arch_templates->lock);
+        std::shared_ptr<ILPArchTemplate> & arch = arch_templates->templates[II];
+        if(arch && arch->mrrg == mrrg)
+            return arch;
+    }
+
+    // built outside of the lock, so that the attempts at other IIs are not held up
+    std::shared_ptr<ILPArchTemplate> arch = buildArchTemplate(mrrg);
+    std::lock_guard<std::mutex> guard(arch_templates->lock);
+    arch_templates->templates[II] = arch;
+    return arch;
+}
+
+std::unique_ptr<Mapper> ILPMapper::clone() const
+{
+    return std::unique_ptr<Mapper>(new ILPMapper(*this));
+}
+
+void ILPMapper::setWarmStart(const Mapping & mapping)
+{
+    if(decomposed)
+        std::cout << "[WARNING] The Decomposed ILP Mapper Does Not Use a Warm Start, Ignoring the Given Mapping" << std::endl;
+    warm_start_mapping = mapping.getMapping();
+    warm_start_II = mapping.getII();
+}
+
 // This is the main mapping function
 // true on success, false on failure
 Mapping ILPMapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph, int II)
 {
-    std::cout << "[INFO] Mapping DFG Onto CGRA Architecture..." << std::endl;
+    // Initial solution for the solver, a given mapping at this II or else a quick annealer run
+    std::map<OpGraphNode*, std::vector<MRRGNode*>> anneal_mapping;
+    const std::map<OpGraphNode*, std::vector<MRRGNode*>>* start = nullptr;
+    if(!warm_start_mapping.empty() && warm_start_II == II)
+    {
+        start = &warm_start_mapping;
+    }
+    else if(warm_start && !decomposed)
+    {
+        if(verbose)
+            std::cout << "[INFO] Warm Starting with the Annealing Mapper..." << std::endl;
+        AnnealMapper anneal_mapper(cgra, warm_start_timelimit, warm_start_args);
+        if(ii_sweep)
+            anneal_mapper.setSweepAttempt(cancel_flag);
+        Mapping anneal_result = anneal_mapper.mapOpGraph(opgraph, II);
+        if(anneal_result.isMapped())
+        {
+            anneal_mapping = anneal_result.getMapping();
+            start = &anneal_mapping;
+        }
+        else if(verbose)
+            std::cout << "[INFO] No Warm Start Mapping Found, Solving without Initial Solution" << std::endl;
+    }
+
+    // Context symmetry breaking, one op is anchored to context 0 and the initial solution is rotated to match
+    OpGraphOp* anchor = nullptr;
+    std::map<OpGraphNode*, std::vector<MRRGNode*>> rotated_mapping;
+    std::shared_ptr<ILPArchTemplate> arch = getArchTemplate(II);
+    const std::vector<MRRGNode*> & rotation = arch->rotation;
+    if(symmetry_breaking && !opgraph->op_nodes.empty() && arch->context_symmetric)
+    {
+        anchor = opgraph->op_nodes[0];
+        if(verbose)
+            std::cout << "[INFO] MRRG Is Identical in All Contexts, Anchoring " << anchor->name << " to Context 0" << std::endl;
+
+        if(start && start->count(anchor) && !start->at(anchor).empty())
+        {
+            unsigned int contexts = (II - start->at(anchor)[0]->cycle) % II;
+            if(verbose && contexts)
+                std::cout << "[INFO] Rotating the Warm Start Mapping by " << contexts << " Contexts" << std::endl;
+            for(auto & node_mapping : *start)
+            {
+                std::vector<MRRGNode*> & nodes = rotated_mapping[node_mapping.first];
+                for(auto n : node_mapping.second)
+                {
+                    for(unsigned int c = 0; c < contexts; c++)
+                        n = rotation[n->id];
+                    nodes.push_back(n);
+                }
+            }
+            start = &rotated_mapping;
+        }
+    }
+
+    if(verbose)
+        std::cout << "[INFO] Mapping DFG Onto CGRA Architecture..." << std::endl;
 
     // Create result obj
     Mapping mapping_result(cgra, II, opgraph);
     
     ILPMapperStatus mapper_status = ILPMapperStatus::UNLISTED_STATUS;
-    switch(solvertype)
+    if(decomposed)
+    {
+        mapper_status = mapDecomposed(opgraph.get(), *arch, &mapping_result, anchor);
+    }
+    else
     {
-        case ILPSolverType::SCIP:
-            mapper_status = SCIPMap(opgraph.get(), II, &mapping_result);
-            break;
+        switch(solvertype)
+        {
+            case ILPSolverType::SCIP:
+                mapper_status = SCIPMap(opgraph.get(), *arch, &mapping_result, start, anchor);
+                break;
 #ifdef USE_GUROBI
-        case ILPSolverType::Gurobi:
-            mapper_status = GurobiMap(opgraph.get(), II, &mapping_result);
-            break;
+            case ILPSolverType::Gurobi:
+                mapper_status = GurobiMap(opgraph.get(), *arch, &mapping_result, start, anchor);
+                break;
 #endif
+        }
     }
     if(mapper_status == ILPMapperStatus::INFEASIBLE)
     {
-        std::cout << "[INFO] CGRA Mapping Infeasible" << std::endl;
-        std::cout << "MapperTimeout: 0" << std::endl;
-        std::cout << "Mapped: 0" << std::endl;
+        if(verbose)
+        {
+            std::cout << "[INFO] CGRA Mapping Infeasible" << std::endl;
+            std::cout << "MapperTimeout: 0" << std::endl;
+            std::cout << "Mapped: 0" << std::endl;
+        }
         mapping_result.setMapped(false);
     }
     else if(mapper_status == ILPMapperStatus::OPTIMAL_FOUND)
     {
-        std::cout << "[INFO] Optimal CGRA Mapping Found" << std::endl;
-        std::cout << "MapperTimeout: 0" << std::endl;
-        std::cout << "Mapped: 1" << std::endl;
+        if(verbose)
+        {
+            std::cout << "[INFO] Optimal CGRA Mapping Found" << std::endl;
+            std::cout << "MapperTimeout: 0" << std::endl;
+            std::cout << "Mapped: 1" << std::endl;
+        }
         mapping_result.setMapped(true);
     }
     else if(mapper_status == ILPMapperStatus::SUBOPTIMAL_FOUND)
     {
-        std::cout << "[INFO] Suboptimal CGRA Mapping Found" << std::endl;
-        std::cout << "MapperTimeout: 0" << std::endl;
-        std::cout << "Mapped: 1" << std::endl;
+        if(verbose)
+        {
+            std::cout << "[INFO] Suboptimal CGRA Mapping Found" << std::endl;
+            std::cout << "MapperTimeout: 0" << std::endl;
+            std::cout << "Mapped: 1" << std::endl;
+        }
         mapping_result.setMapped(true);
     }
     else if(mapper_status == ILPMapperStatus::TIMEOUT)
     {
-        std::cout << "[INFO] CGRA Mapping Timed Out" << std::endl;
-        std::cout << "MapperTimeout: 1" << std::endl;
-        std::cout << "Mapped: 0" << std::endl;
+        if(verbose)
+        {
+            std::cout << "[INFO] CGRA Mapping Timed Out" << std::endl;
+            std::cout << "MapperTimeout: 1" << std::endl;
+            std::cout << "Mapped: 0" << std::endl;
+        }
         mapping_result.setMapped(false);
     }
     else if(mapper_status == ILPMapperStatus::INTERRUPTED)
     {
-        std::cout << "[INFO] CGRA Mapping Interrupted" << std::endl;
-        std::cout << "MapperTimeout: 0" << std::endl;
-        std::cout << "Mapped: 0" << std::endl;
+        if(verbose)
+        {
+            std::cout << "[INFO] CGRA Mapping Interrupted" << std::endl;
+            std::cout << "MapperTimeout: 0" << std::endl;
+            std::cout << "Mapped: 0" << std::endl;
+        }
         mapping_result.setMapped(false);
     }
     else if(mapper_status == ILPMapperStatus::UNLISTED_STATUS)
     {
         std::cout << "[ERROR] CGRA Mapping Results in Unlisted Status" << std::endl;
         std::cout << "[INFO] Please Report this Bug to Xander Chin(xan@ece.utoronto.ca)" << std::endl;
-        std::cout << "MapperTimeout: 0" << std::endl;
-        std::cout << "Mapped: 0" << std::endl;
+        if(verbose)
+        {
+            std::cout << "MapperTimeout: 0" << std::endl;
+            std::cout << "Mapped: 0" << std::endl;
+        }
         mapping_result.setMapped(false);
     }
 
     return mapping_result;
 }
 
-static SCIP_RETCODE scip_run_solver(ILPMapperStatus & mapperstatus, MRRG * mrrg, OpGraph * opgraph, double timelimit, double scip_mipgap, int scip_solnlimit, Mapping* mapping_result)
+// Variables of the ILP that can be part of a legal mapping, indexed by OpGraphNode::id and MRRGNode::id.
+// All the other variables are 0 in every legal mapping and are left out of the model.
+typedef struct
 {
-    SCIP* scip;
-    SCIP_CALL( SCIPcreate(&scip) );
-    SCIP_CALL( SCIPincludeDefaultPlugins(scip) );
-
-    SCIP_CALL( SCIPsetRealParam(scip, "limits/gap", scip_mipgap) );
-    if(timelimit != 0.0)
-        SCIP_CALL( SCIPsetRealParam(scip, "limits/time", timelimit) );
-
-    if(scip_solnlimit != 0)
-        SCIP_CALL( SCIPsetIntParam(scip,"limits/solutions", scip_solnlimit) );
-
-
-    const int num_dfg_vals  = opgraph->val_nodes.size();
-    const int num_dfg_ops   = opgraph->op_nodes.size();
-    const int num_mrrg_r    = mrrg->routing_nodes.size();
-    const int num_mrrg_f    = mrrg->function_nodes.size();
-
-    std::map<OpGraphVal*, std::map<MRRGNode*, SCIP_VAR**> > R_var_map;
-    std::map<OpGraphVal*, std::map<MRRGNode*, SCIP_VAR**> > S_var_map;
-    std::map<OpGraphOp*,  std::map<MRRGNode*, SCIP_VAR**> > F_var_map;
+    std::vector<std::vector<char>> F;               // op placed on function node
+    std::vector<std::vector<std::vector<char>>> S;  // fanout of val routed through routing node
+    std::vector<std::vector<char>> R;               // val routed through routing node, any of its fanouts
+} ILPVarDomain;
+
+// Prunes the ILP variables. An op can only be placed on a function node that supports it, and a fanout of a val
+// can only use the routing nodes that are reachable from a legal placement of the producer and that reach the
+// operand of a legal placement of the consumer. Placements whose output or operands can not be routed are
+// removed in turn, until nothing changes. If anchor is given, it can only be placed in context 0.
+static void pruneILPVars(ILPVarDomain & domain, const ILPArchTemplate & arch, OpGraph * opgraph, OpGraphOp * anchor)
+{
+    MRRG* mrrg = arch.mrrg;
+    const unsigned int num_nodes = mrrg->getNumNodes();
+    const unsigned int num_opgraph_nodes = opgraph->op_nodes.size() + opgraph->val_nodes.size();
 
-    // Create variables
-    const int count_R = num_dfg_vals * num_mrrg_r;
-    SCIP_VAR** R = new SCIP_VAR*[count_R];
+    domain.F.assign(num_opgraph_nodes, std::vector<char>());
+    domain.S.assign(num_opgraph_nodes, std::vector<std::vector<char>>());
+    domain.R.assign(num_opgraph_nodes, std::vector<char>());
 
-    const int count_F = num_dfg_ops * num_mrrg_f;
-    SCIP_VAR** F = new SCIP_VAR*[count_F];
+    for(auto & op : opgraph->op_nodes)
+    {
+        domain.F[op->id].assign(num_nodes, 0);
+        for(auto & f : mrrg->function_nodes)
+            domain.F[op->id][f->id] = f->canMapOp(op) && (op != anchor || f->cycle == 0);
+    }
 
-    std::vector<std::pair<SCIP_VAR**, int>> S; // Vecotr of VAR array and number of fanouts
-    for(auto & val : opgraph->val_nodes)
+    std::vector<char> reachable(num_nodes);
+    std::vector<MRRGNode*> queue;
+    bool changed = true;
+    while(changed)
     {
-        for(auto & r : mrrg->routing_nodes)
+        changed = false;
+        for(auto & val : opgraph->val_nodes)
         {
-            int num_fanouts = val->output.size();
-            if(num_fanouts > 1)
+            // forward from the outputs of the legal placements of the producer
+            reachable.assign(num_nodes, 0);
+            queue.clear();
+            if(val->input)
+            {
+                for(auto & f : mrrg->function_nodes)
+                {
+                    if(!domain.F[val->input->id][f->id])
+                        continue;
+                    MRRGNode* r = arch.fu_output[f->id];
+                    if(r->type == MRRG_NODE_ROUTING && !reachable[r->id])
+                    {
+                        reachable[r->id] = 1;
+                        queue.push_back(r);
+                    }
+                }
+            }
+            // the output of a function node only carries the val of the op placed on it (Constraint 5)
+            while(!queue.empty())
             {
-                S.emplace_back(std::make_pair(new SCIP_VAR*[num_fanouts], num_fanouts));
+                MRRGNode* n = queue.back();
+                queue.pop_back();
+                for(auto & next : arch.routing_fanouts[n->id])
+                {
+                    if(!arch.is_fu_output[next->id] && !reachable[next->id])
+                    {
+                        reachable[next->id] = 1;
+                        queue.push_back(next);
+                    }
+                }
             }
-            else
+
+            // backward from the operands of the legal placements of each consumer
+            domain.R[val->id].assign(num_nodes, 0);
+            domain.S[val->id].resize(val->output.size());
+            for(unsigned int i = 0; i < val->output.size(); i++)
             {
-                S.emplace_back(std::make_pair(nullptr, num_fanouts));
+                std::vector<char> & sub_val = domain.S[val->id][i];
+                sub_val.assign(num_nodes, 0);
+
+                OpGraphOp* op = val->output[i];
+                unsigned int operand = val->output_operand[i];
+                for(auto & f : mrrg->function_nodes)
+                {
+                    if(!domain.F[op->id][f->id] || f->fanin.size() <= operand)
+                        continue;
+                    MRRGNode* r = f->fanin[operand];
+                    if(reachable[r->id] && !sub_val[r->id])
+                    {
+                        sub_val[r->id] = 1;
+                        queue.push_back(r);
+                    }
+                }
+                while(!queue.empty())
+                {
+                    MRRGNode* n = queue.back();
+                    queue.pop_back();
+                    for(auto & prev : n->fanin)
+                    {
+                        if(reachable[prev->id] && !sub_val[prev->id])
+                        {
+                            sub_val[prev->id] = 1;
+                            queue.push_back(prev);
+                        }
+                    }
+                }
+
+                for(auto & r : mrrg->routing_nodes)
+                    domain.R[val->id][r->id] |= sub_val[r->id];
             }
         }
-    }
 
-    // Create the problem
-    SCIP_CALL( SCIPcreateProbBasic(scip, "cgrame_map") );
+        for(auto & val : opgraph->val_nodes)
+        {
+            for(unsigned int i = 0; i < val->output.size(); i++)
+            {
+                const std::vector<char> & sub_val = domain.S[val->id][i];
 
-    for(int i = 0; i < count_R; ++i)
-    {
-        // Objective function is implied here
-        SCIP_CALL( SCIPcreateVarBasic(scip, &R[i], "R", 0.0, 1.0, 1.0, SCIP_VARTYPE_BINARY) );
-        SCIP_CALL( SCIPaddVar(scip, R[i]) );
-    }
+                // the consumer needs its operand routed
+                OpGraphOp* op = val->output[i];
+                unsigned int operand = val->output_operand[i];
+                for(auto & f : mrrg->function_nodes)
+                {
+                    if(domain.F[op->id][f->id] && (f->fanin.size() <= operand || !sub_val[f->fanin[operand]->id]))
+                    {
+                        domain.F[op->id][f->id] = 0;
+                        changed = true;
+                    }
+                }
 
-    for(int i = 0; i < count_F; ++i)
-    {
-        SCIP_CALL( SCIPcreateVarBasic(scip, &F[i], "F", 0.0, 1.0, 0.0, SCIP_VARTYPE_BINARY) );
-        SCIP_CALL( SCIPaddVar(scip, F[i]) );
+                // the producer needs its output routed to every fanout
+                if(!val->input)
+                    continue;
+                for(auto & f : mrrg->function_nodes)
+                {
+                    if(domain.F[val->input->id][f->id] && !sub_val[arch.fu_output[f->id]->id])
+                    {
+                        domain.F[val->input->id][f->id] = 0;
+                        changed = true;
+                    }
+                }
+            }
+        }
     }
+}
+
+// Placement only ILP of the decomposed mapper, over the F variables that pruneILPVars() keeps. Routing is
+// replaced by support rows: an op placed on fu needs each consumer placed on a function node whose operand
+// is reachable from the output of fu (within max_distance routing nodes, if given).
+struct ILPPlacementSupport
+{
+    OpGraphOp* op;
+    MRRGNode* fu;
+    OpGraphOp* consumer;
+    std::vector<MRRGNode*> consumer_fus;
+};
 
-    for(auto & s : S)
+struct ILPPlacementModel
+{
+    const ILPArchTemplate* arch;
+    std::vector<std::vector<char>> F;               // op placed on function node, by OpGraphNode::id and MRRGNode::id
+    std::vector<ILPPlacementSupport> supports;
+    // no-good cuts, placements that failed to route, at most all but one of each cut can be chosen again
+    std::vector<std::vector<std::pair<OpGraphOp*, MRRGNode*>>> cuts;
+};
+
+static void buildPlacementModel(ILPPlacementModel & model, const ILPArchTemplate & arch, OpGraph * opgraph, OpGraphOp * anchor, int max_distance)
+{
+    MRRG* mrrg = arch.mrrg;
+    const unsigned int num_nodes = mrrg->getNumNodes();
+
+    ILPVarDomain domain;
+    pruneILPVars(domain, arch, opgraph, anchor);
+    model.arch = &arch;
+    model.F = domain.F;
+    model.supports.clear();
+    model.cuts.clear();
+
+    // the operands reachable from the output of each function node, with the length of the shortest path
+    // in routing nodes. Paths can not pass through the output of another function node (Constraint 5).
+    std::vector<int> distance(num_nodes);
+    std::vector<MRRGNode*> frontier, next_frontier;
+    std::vector<std::tuple<MRRGNode*, unsigned int, int>> reached;
+    for(auto & f : mrrg->function_nodes)
     {
-        if(s.second <= 1)
+        OpGraphOp* producer = nullptr;
+        for(auto & op : opgraph->op_nodes)
+        {
+            if(op->output && model.F[op->id][f->id])
+            {
+                producer = op;
+                break;
+            }
+        }
+        if(!producer)
             continue;
-        else
+
+        distance.assign(num_nodes, -1);
+        reached.clear();
+        frontier.assign(1, arch.fu_output[f->id]);
+        distance[arch.fu_output[f->id]->id] = 1;
+        while(!frontier.empty())
         {
-            for(int i = 0; i < s.second; ++i)
+            next_frontier.clear();
+            for(auto & r : frontier)
             {
-                SCIP_CALL( SCIPcreateVarBasic(scip, &(s.first[i]), "S", 0.0, 1.0, 0.0, SCIP_VARTYPE_BINARY) );
-                SCIP_CALL( SCIPaddVar(scip, s.first[i]) );
+                for(auto & operand_fanout : arch.operand_fanouts[r->id])
+                    reached.push_back(std::make_tuple(operand_fanout.first, operand_fanout.second, distance[r->id]));
+                if(max_distance > 0 && distance[r->id] >= max_distance)
+                    continue;
+                for(auto & next : arch.routing_fanouts[r->id])
+                {
+                    if(distance[next->id] < 0 && !arch.is_fu_output[next->id])
+                    {
+                        distance[next->id] = distance[r->id] + 1;
+                        next_frontier.push_back(next);
+                    }
+                }
             }
+            frontier.swap(next_frontier);
         }
-    }
 
-    // Populate maps
-    int constr_count = 0;
-    int j = 0;
-    for(auto & val : opgraph->val_nodes)
-    {
-        int i = 0;
-        for(auto & r : mrrg->routing_nodes)
+        for(auto & op : opgraph->op_nodes)
         {
-            R_var_map[val][r] = &R[j * num_mrrg_r + i];
-            SCIP_CALL( SCIPchgVarName(scip, *R_var_map[val][r], ("R_" + std::to_string(j) + "_" + std::to_string(i)).c_str()) );
-            auto temp_it = S.begin() + (j * num_mrrg_r + i);
-            if(temp_it->second > 1)
+            if(!op->output || !model.F[op->id][f->id])
+                continue;
+            OpGraphVal* val = op->output;
+            for(unsigned int i = 0; i < val->output.size(); i++)
             {
-                S_var_map[val][r] = temp_it->first;
-                for(int k = 0; k < val->output.size(); k++)
+                ILPPlacementSupport support = {op, f, val->output[i], std::vector<MRRGNode*>()};
+                for(auto & operand_fanout : reached)
                 {
-                    SCIP_CALL( SCIPchgVarName(scip, S_var_map[val][r][k], ("R_" + std::to_string(j) + "_" + std::to_string(i) + "_" + std::to_string(k)).c_str()) );
-                    SCIP_CONS* temp_cons;
-                    SCIP_VAR* temp_var[2] = {*(R_var_map[val][r]), S_var_map[val][r][k]};
-                    SCIP_Real temp_real[2] = {1.0, -1.0};
-                    SCIP_CALL( SCIPcreateConsBasicLinear(scip, &temp_cons, ("sub_val_" + std::to_string(constr_count++)).c_str(), 2, temp_var, temp_real, 0.0, SCIPinfinity(scip)) );
-                    SCIP_CALL( SCIPaddCons(scip, temp_cons) );
-                    SCIP_CALL( SCIPreleaseCons(scip, &temp_cons) );
+                    MRRGNode* fu = std::get<0>(operand_fanout);
+                    if(std::get<1>(operand_fanout) == val->output_operand[i] && model.F[support.consumer->id][fu->id])
+                        support.consumer_fus.push_back(fu);
                 }
+                model.supports.push_back(support);
             }
-            else
-                S_var_map[val][r] = R_var_map[val][r];
-            i++;
         }
-        j++;
     }
+}
 
-    int p = 0;
+// Collects the variables that are 1 in a mapping, to give it to the solver as the initial solution.
+// The mapping only has the routing nodes of each val, the path of each fanout is traced back from
+// the operand of the consumer. Returns false if the mapping is incomplete or uses a pruned variable.
+template<typename Var>
+static bool getStartVars(const std::map<OpGraphNode*, std::vector<MRRGNode*>> & mapping, MRRG * mrrg, OpGraph * opgraph,
+    const std::vector<std::vector<Var*>> & R_vars, const std::vector<std::vector<std::vector<Var*>>> & S_vars, const std::vector<std::vector<Var*>> & F_vars,
+    std::vector<Var*> & start_vars)
+{
+    start_vars.clear();
+
+    // placement, indexed by OpGraphNode::id
+    std::vector<MRRGNode*> placement(opgraph->op_nodes.size(), nullptr);
     for(auto & op : opgraph->op_nodes)
     {
-        int q = 0;
-        for(auto & f : mrrg->function_nodes)
-        {
-            F_var_map[op][f] = &F[p * num_mrrg_f + q];
-            SCIP_CALL( SCIPchgVarName(scip, *F_var_map[op][f], ("F_" + std::to_string(p) + "_" + std::to_string(q)).c_str()) );
-            q++;
-        }
-        p++;
+        auto it = mapping.find(op);
+        if(it == mapping.end() || it->second.size() != 1 || !F_vars[op->id][it->second[0]->id])
+            return false;
+        placement[op->id] = it->second[0];
+        start_vars.push_back(F_vars[op->id][it->second[0]->id]);
     }
 
-    //Constraint 1
-    constr_count = 0;
-    for(int i = 0; i < num_mrrg_r; i++)
+    std::vector<char> routed(mrrg->getNumNodes());
+    for(auto & val : opgraph->val_nodes)
     {
-        SCIP_CONS* constraint;
-        SCIP_Real coeffs[num_dfg_vals];
-        SCIP_VAR* vars [num_dfg_vals];
+        if(val->output.empty())
+            continue;
+        auto it = mapping.find(val);
+        if(it == mapping.end())
+            return false;
 
-        for(int j = 0; j < num_dfg_vals; j++)
+        routed.assign(mrrg->getNumNodes(), 0);
+        for(auto & r : it->second)
         {
-            coeffs[j] = 1.0;
-            vars[j] = R[j * num_mrrg_r + i];
+            // the heuristic mappers include the function node of the producer
+            if(r->type != MRRG_NODE_ROUTING)
+                continue;
+            if(!R_vars[val->id][r->id])
+                return false;
+            routed[r->id] = 1;
+            start_vars.push_back(R_vars[val->id][r->id]);
         }
 
-        SCIP_CALL( SCIPcreateConsBasicLinear(scip, &constraint, ("route_exclusivity_" + std::to_string(constr_count++)).c_str(), num_dfg_vals, vars, coeffs, -SCIPinfinity(scip), 1.0) );
-        SCIP_CALL( SCIPaddCons(scip, constraint) );
-        SCIP_CALL( SCIPreleaseCons(scip, &constraint) );
-    }
-
-    // Constraint 2
-    constr_count = 0;
-    for(int p = 0; p < num_mrrg_f; p++)
-    {
-        SCIP_CONS* constraint;
-        SCIP_Real coeffs[num_dfg_ops];
-        SCIP_VAR* vars [num_dfg_ops];
-
-        for(int q = 0; q < num_dfg_ops; q++)
+        if(val->output.size() == 1)
+            continue;
+        for(unsigned int k = 0; k < val->output.size(); k++)
         {
-            coeffs[q] = 1.0;
-            vars[q] = F[q * num_mrrg_f + p];
-        }
+            MRRGNode* fu = placement[val->output[k]->id];
+            unsigned int operand = val->output_operand[k];
+            if(fu->fanin.size() <= operand)
+                return false;
+
+            // a routed tree has a single routed fanin per node, back to the output of the producer
+            MRRGNode* n = fu->fanin[operand];
+            while(n && routed[n->id] == 1)
+            {
+                if(!S_vars[val->id][k][n->id])
+                    return false;
+                start_vars.push_back(S_vars[val->id][k][n->id]);
+                routed[n->id] = 2;
 
-        SCIP_CALL( SCIPcreateConsBasicLinear(scip, &constraint, ("function_unit_exclusivity_" + std::to_string(constr_count++)).c_str(), num_dfg_ops, vars, coeffs, -SCIPinfinity(scip), 1.0) );
-        SCIP_CALL( SCIPaddCons(scip, constraint) );
-        SCIP_CALL( SCIPreleaseCons(scip, &constraint) );
+                MRRGNode* prev = nullptr;
+                for(auto & fanin : n->fanin)
+                {
+                    if(fanin->type == MRRG_NODE_ROUTING && routed[fanin->id])
+                        prev = fanin;
+                }
+                n = prev;
+            }
+            for(auto & r : it->second)
+            {
+                if(routed[r->id])
+                    routed[r->id] = 1;
+            }
+        }
     }
 
-    // Constraint 3
-    constr_count = 0;
-    for(int q = 0; q < num_dfg_ops; q++)
+    return true;
+}
+
+// The variables on the left of Constraint 4 for fanout i of val at routing node r: the S variables of the fanout
+// on the routing fanouts of r, and the F variables of the consumer on the function nodes that r feeds at the
+// operand of the fanout. One of them has to be 1 if the S variable at r is.
+template<typename Var>
+static void getFanoutRoutingVars(const ILPArchTemplate & arch, OpGraphVal * val, unsigned int i, MRRGNode * r,
+    const std::vector<std::vector<std::vector<Var*>>> & S_vars, const std::vector<std::vector<Var*>> & F_vars, std::vector<Var*> & fanout_vars)
+{
+    fanout_vars.clear();
+    for(auto & mrrg_fanout : arch.routing_fanouts[r->id])
     {
-        SCIP_CONS* constraint;
-        SCIP_Real coeffs[num_mrrg_f];
-        SCIP_VAR* vars [num_mrrg_f];
+        if(Var* var = S_vars[val->id][i][mrrg_fanout->id])
+            fanout_vars.push_back(var);
+    }
+    for(auto & operand_fanout : arch.operand_fanouts[r->id])
+    {
+        if(operand_fanout.second != val->output_operand[i])
+            continue;
+        if(Var* var = F_vars[val->output[i]->id][operand_fanout.first->id])
+            fanout_vars.push_back(var);
+    }
+}
+
+// Constraint handler for the lazy Constraint 4. It has a single constraint that locks all S and F variables,
+// as presolving can not see the rows that are not added yet, and adds a row of Constraint 4 once a solution
+// violates it. The variables are those of the transformed problem.
+struct SCIP_ConshdlrData
+{
+    const ILPArchTemplate* arch;
+    OpGraph* opgraph;
+    // the routing nodes that each val can use, with their R variables, indexed by OpGraphNode::id
+    std::vector<std::vector<std::pair<MRRGNode*, SCIP_VAR*>>> R_vars;
+    std::vector<std::vector<std::vector<SCIP_VAR*>>> S_vars;
+    std::vector<std::vector<SCIP_VAR*>> F_vars;
+};
+
+// Checks Constraint 4 on sol, the LP or pseudo solution if NULL. If add is set the violated rows are added,
+// otherwise the check stops at the first one. Only the nodes that a val is routed through are looked at, as
+// the S variables of the fanouts at a node are at most its R variable.
+static SCIP_RETCODE enforceFanoutRouting(SCIP* scip, SCIP_CONSHDLR* conshdlr, SCIP_SOL* sol, bool add, SCIP_RESULT* result)
+{
+    SCIP_ConshdlrData* data = SCIPconshdlrGetData(conshdlr);
+    const ILPArchTemplate & arch = *data->arch;
+    *result = SCIP_FEASIBLE;
 
-        for(int p = 0; p < num_mrrg_f; p++)
+    std::vector<SCIP_VAR*> fanout_vars;
+    for(auto & val : data->opgraph->val_nodes)
+    {
+        for(auto & routing : data->R_vars[val->id])
         {
-            coeffs[p] = 1.0;
-            vars[p] = F[q * num_mrrg_f + p];
-        }
+            if(SCIPisFeasZero(scip, SCIPgetSolVal(scip, sol, routing.second)))
+                continue;
 
-        SCIP_CALL( SCIPcreateConsBasicLinear(scip, &constraint, ("ensure_all_ops_mapped_" + std::to_string(constr_count++)).c_str(), num_mrrg_f, vars, coeffs, 1.0, 1.0) );
-        SCIP_CALL( SCIPaddCons(scip, constraint) );
-        SCIP_CALL( SCIPreleaseCons(scip, &constraint) );
+            MRRGNode* r = routing.first;
+            for(unsigned int i = 0; i < val->output.size(); i++)
+            {
+                SCIP_VAR* sub_var = data->S_vars[val->id][i][r->id];
+                if(!sub_var)
+                    continue;
+                SCIP_Real routed = SCIPgetSolVal(scip, sol, sub_var);
+                if(SCIPisFeasZero(scip, routed))
+                    continue;
+
+                getFanoutRoutingVars(arch, val, i, r, data->S_vars, data->F_vars, fanout_vars);
+                SCIP_Real sum_of_fanouts = 0.0;
+                for(auto & var : fanout_vars)
+                    sum_of_fanouts += SCIPgetSolVal(scip, sol, var);
+                if(!SCIPisFeasLT(scip, sum_of_fanouts, routed))
+                    continue;
+
+                if(!add)
+                {
+                    *result = SCIP_INFEASIBLE;
+                    return SCIP_OKAY;
+                }
+
+                std::vector<SCIP_Real> coeffs(fanout_vars.size(), 1.0);
+                fanout_vars.push_back(sub_var);
+                coeffs.push_back(-1.0);
+                SCIP_CONS* constraint;
+                SCIP_CALL( SCIPcreateConsLinear(scip, &constraint, ILP_NAME("lazy_fanout_routing_" + std::to_string(val->id) + "_" + std::to_string(i) + "_" + std::to_string(r->id)).c_str(), fanout_vars.size(), fanout_vars.data(), coeffs.data(), 0.0, SCIPinfinity(scip),
+                    TRUE, TRUE, TRUE, TRUE, TRUE, FALSE, FALSE, FALSE, FALSE, FALSE) );
+                SCIP_CALL( SCIPaddCons(scip, constraint) );
+                SCIP_CALL( SCIPreleaseCons(scip, &constraint) );
+                *result = SCIP_CONSADDED;
+            }
+        }
     }
+    return SCIP_OKAY;
+}
 
-    // Constraint 4 - Fanout Routing
-    int constr_count1 = 0;
-    int constr_count2 = 0;
-    for(auto &val: opgraph->val_nodes)
+static SCIP_DECL_CONSENFOLP(consEnfolpFanoutRouting)
+{
+    SCIP_CALL( enforceFanoutRouting(scip, conshdlr, NULL, true, result) );
+    return SCIP_OKAY;
+}
+
+static SCIP_DECL_CONSENFOPS(consEnfopsFanoutRouting)
+{
+    SCIP_CALL( enforceFanoutRouting(scip, conshdlr, NULL, true, result) );
+    return SCIP_OKAY;
+}
+
+static SCIP_DECL_CONSCHECK(consCheckFanoutRouting)
+{
+    SCIP_CALL( enforceFanoutRouting(scip, conshdlr, sol, false, result) );
+    return SCIP_OKAY;
+}
+
+static SCIP_DECL_CONSLOCK(consLockFanoutRouting)
+{
+    SCIP_ConshdlrData* data = SCIPconshdlrGetData(conshdlr);
+    for(auto & val_vars : data->S_vars)
     {
-        for(auto &r: mrrg->routing_nodes)
+        for(auto & sub_vars : val_vars)
         {
-            int val_fanouts = val->output.size();
-            for(int i = 0; i < val_fanouts; i++)
+            for(auto & var : sub_vars)
             {
-                std::vector<SCIP_VAR*> sum_of_fanouts;
-                std::vector<SCIP_Real> coeff_sum_of_fanouts;
-                int fanout_count = 0;
-                for(auto &mrrg_fanout : r->fanout)
-                {
-                    if(mrrg_fanout->type == MRRG_NODE_ROUTING)
-                    {
-                        sum_of_fanouts.push_back(S_var_map[val][mrrg_fanout][i]);
-                        coeff_sum_of_fanouts.push_back(1.0);
-                        fanout_count++;
-                    }
-                    else if(mrrg_fanout->type == MRRG_NODE_FUNCTION)
-                    {
-                        auto &op =  val->output[i];
-                        int operand = val->output_operand[i];
+                if(var)
+                    SCIP_CALL( SCIPaddVarLocks(scip, var, nlockspos + nlocksneg, nlockspos + nlocksneg) );
+            }
+        }
+    }
+    for(auto & op_vars : data->F_vars)
+    {
+        for(auto & var : op_vars)
+        {
+            if(var)
+                SCIP_CALL( SCIPaddVarLocks(scip, var, nlockspos + nlocksneg, nlockspos + nlocksneg) );
+        }
+    }
+    return SCIP_OKAY;
+}
 
-                        if(mrrg_fanout->fanin.size() > operand && mrrg_fanout->fanin.at(operand) == r)
-                        {
-                            sum_of_fanouts.push_back(*(F_var_map[op][mrrg_fanout]));
-                            coeff_sum_of_fanouts.push_back(1.0);
-                            fanout_count++;
-                        }
-                    }
-                    else
+// Event handler that interrupts the solve once the II sweep cancels the attempt, checked after every LP and node
+struct SCIP_EventhdlrData
+{
+    const std::atomic<bool>* cancel;
+};
+
+static SCIP_DECL_EVENTEXEC(eventExecCancel)
+{
+    if(*SCIPeventhdlrGetData(eventhdlr)->cancel)
+        SCIP_CALL( SCIPinterruptSolve(scip) );
+    return SCIP_OKAY;
+}
+
+static SCIP_DECL_EVENTINIT(eventInitCancel)
+{
+    SCIP_CALL( SCIPcatchEvent(scip, SCIP_EVENTTYPE_NODESOLVED | SCIP_EVENTTYPE_LPSOLVED, eventhdlr, NULL, NULL) );
+    return SCIP_OKAY;
+}
+
+static SCIP_DECL_EVENTEXIT(eventExitCancel)
+{
+    SCIP_CALL( SCIPdropEvent(scip, SCIP_EVENTTYPE_NODESOLVED | SCIP_EVENTTYPE_LPSOLVED, eventhdlr, NULL, -1) );
+    return SCIP_OKAY;
+}
+
+// data has to outlive the solve
+static SCIP_RETCODE includeCancelEventhdlr(SCIP* scip, SCIP_EventhdlrData* data)
+{
+    SCIP_EVENTHDLR* eventhdlr;
+    SCIP_CALL( SCIPincludeEventhdlrBasic(scip, &eventhdlr, "cgrame_cancel", "interrupts the solve when the II sweep cancels it", eventExecCancel, data) );
+    SCIP_CALL( SCIPsetEventhdlrInit(scip, eventhdlr, eventInitCancel) );
+    SCIP_CALL( SCIPsetEventhdlrExit(scip, eventhdlr, eventExitCancel) );
+    return SCIP_OKAY;
+}
+
+static SCIP_RETCODE scip_run_solver(ILPMapperStatus & mapperstatus, const ILPArchTemplate & arch, OpGraph * opgraph, double timelimit, double scip_mipgap, int scip_solnlimit, Mapping* mapping_result, const std::map<OpGraphNode*, std::vector<MRRGNode*>>* start, OpGraphOp* anchor, const std::atomic<bool>* cancel, bool lazy_routing, bool verbose)
+{
+    MRRG* mrrg = arch.mrrg;
+    SCIP* scip;
+    SCIP_CALL( SCIPcreate(&scip) );
+    SCIP_CALL( SCIPincludeDefaultPlugins(scip) );
+    if(!verbose)
+        SCIP_CALL( SCIPsetIntParam(scip, "display/verblevel", 0) );
+
+    SCIP_CALL( SCIPsetRealParam(scip, "limits/gap", scip_mipgap) );
+    if(timelimit != 0.0)
+        SCIP_CALL( SCIPsetRealParam(scip, "limits/time", timelimit) );
+
+    if(scip_solnlimit != 0)
+        SCIP_CALL( SCIPsetIntParam(scip,"limits/solutions", scip_solnlimit) );
+
+    SCIP_EventhdlrData cancel_data = {cancel};
+    if(cancel)
+        SCIP_CALL( includeCancelEventhdlr(scip, &cancel_data) );
+
+    SCIP_ConshdlrData lazy_data;
+    SCIP_CONSHDLR* lazy_conshdlr = NULL;
+    if(lazy_routing)
+        SCIP_CALL( SCIPincludeConshdlrBasic(scip, &lazy_conshdlr, "cgrame_fanout_routing", "lazy fanout routing (Constraint 4)", -1, -1, -1, TRUE,
+            consEnfolpFanoutRouting, consEnfopsFanoutRouting, consCheckFanoutRouting, consLockFanoutRouting, &lazy_data) );
+
+
+    // Only the variables that can be part of a legal mapping are created
+    ILPVarDomain domain;
+    pruneILPVars(domain, arch, opgraph, anchor);
+
+    // variables indexed by OpGraphNode::id and MRRGNode::id, nullptr where pruned
+    const unsigned int num_opgraph_nodes = opgraph->op_nodes.size() + opgraph->val_nodes.size();
+    std::vector<std::vector<SCIP_VAR*>> R_vars(num_opgraph_nodes);
+    std::vector<std::vector<std::vector<SCIP_VAR*>>> S_vars(num_opgraph_nodes); // per fanout, the R variable if there is one fanout
+    std::vector<std::vector<SCIP_VAR*>> F_vars(num_opgraph_nodes);
+    std::vector<SCIP_VAR*> all_vars;
+
+    // Create the problem
+    SCIP_CALL( SCIPcreateProbBasic(scip, "cgrame_map") );
+
+    // Create variables
+    int j = 0;
+    for(auto & val : opgraph->val_nodes)
+    {
+        int num_fanouts = val->output.size();
+        std::vector<SCIP_VAR*> & val_vars = R_vars[val->id];
+        std::vector<std::vector<SCIP_VAR*>> & sub_vars = S_vars[val->id];
+        val_vars.assign(mrrg->getNumNodes(), nullptr);
+        sub_vars.assign(num_fanouts, std::vector<SCIP_VAR*>(mrrg->getNumNodes(), nullptr));
+
+        int i = 0;
+        for(auto & r : mrrg->routing_nodes)
+        {
+            if(domain.R[val->id][r->id])
+            {
+                // Objective function is implied here
+                SCIP_VAR* var;
+                SCIP_CALL( SCIPcreateVarBasic(scip, &var, ILP_NAME("R_" + std::to_string(j) + "_" + std::to_string(i)).c_str(), 0.0, 1.0, 1.0, SCIP_VARTYPE_BINARY) );
+                SCIP_CALL( SCIPaddVar(scip, var) );
+                all_vars.push_back(var);
+                val_vars[r->id] = var;
+
+                if(num_fanouts > 1)
+                {
+                    for(int k = 0; k < num_fanouts; k++)
                     {
-                        assert(0);
+                        if(!domain.S[val->id][k][r->id])
+                            continue;
+
+                        SCIP_VAR* sub_var;
+                        SCIP_CALL( SCIPcreateVarBasic(scip, &sub_var, ILP_NAME("R_" + std::to_string(j) + "_" + std::to_string(i) + "_" + std::to_string(k)).c_str(), 0.0, 1.0, 0.0, SCIP_VARTYPE_BINARY) );
+                        SCIP_CALL( SCIPaddVar(scip, sub_var) );
+                        all_vars.push_back(sub_var);
+                        sub_vars[k][r->id] = sub_var;
+
+                        SCIP_CONS* temp_cons;
+                        SCIP_VAR* temp_var[2] = {var, sub_var};
+                        SCIP_Real temp_real[2] = {1.0, -1.0};
+                        SCIP_CALL( SCIPcreateConsBasicLinear(scip, &temp_cons, ILP_NAME("sub_val_" + std::to_string(j) + "_" + std::to_string(i) + "_" + std::to_string(k)).c_str(), 2, temp_var, temp_real, 0.0, SCIPinfinity(scip)) );
+                        SCIP_CALL( SCIPaddCons(scip, temp_cons) );
+                        SCIP_CALL( SCIPreleaseCons(scip, &temp_cons) );
                     }
                 }
+                else if(num_fanouts == 1)
+                    sub_vars[0][r->id] = var;
+            }
+            i++;
+        }
+        j++;
+    }
 
-                SCIP_CONS* constraint;
-                sum_of_fanouts.push_back(S_var_map[val][r][i]);
-                coeff_sum_of_fanouts.push_back(-1.0);
-                SCIP_CALL( SCIPcreateConsBasicLinear(scip, &constraint, ("fanout_routing_" + std::to_string(constr_count1++)).c_str(), sum_of_fanouts.size(), &sum_of_fanouts[0], &coeff_sum_of_fanouts[0], 0.0, SCIPinfinity(scip)) );
-                SCIP_CALL( SCIPaddCons(scip, constraint) );
-                SCIP_CALL( SCIPreleaseCons(scip, &constraint) );
+    int p = 0;
+    for(auto & op : opgraph->op_nodes)
+    {
+        std::vector<SCIP_VAR*> & op_vars = F_vars[op->id];
+        op_vars.assign(mrrg->function_nodes.size(), nullptr);
+
+        int q = 0;
+        for(auto & f : mrrg->function_nodes)
+        {
+            if(domain.F[op->id][f->id])
+            {
+                SCIP_VAR* var;
+                SCIP_CALL( SCIPcreateVarBasic(scip, &var, ILP_NAME("F_" + std::to_string(p) + "_" + std::to_string(q)).c_str(), 0.0, 1.0, 0.0, SCIP_VARTYPE_BINARY) );
+                SCIP_CALL( SCIPaddVar(scip, var) );
+                all_vars.push_back(var);
+                op_vars[f->id] = var;
             }
+            q++;
         }
+        p++;
     }
 
-    // MUX Exclusivity Constraint
-    constr_count = 0;
-    for(auto &val: opgraph->val_nodes)
+    if(verbose)
+        std::cout << "[INFO] ILP Variables: " << all_vars.size() << " (Dense Model: "
+            << (opgraph->val_nodes.size() * mrrg->routing_nodes.size() + opgraph->op_nodes.size() * mrrg->function_nodes.size()) << " R and F Variables)" << std::endl;
+
+    // adds sum(vars * coeffs) in [lhs, rhs]
+    auto addLinear = [&](const std::string & name, std::vector<SCIP_VAR*> & vars, std::vector<SCIP_Real> & coeffs, SCIP_Real lhs, SCIP_Real rhs) -> SCIP_RETCODE
     {
-        for(auto &r: mrrg->routing_nodes)
+        SCIP_CONS* constraint;
+        SCIP_CALL( SCIPcreateConsBasicLinear(scip, &constraint, name.c_str(), vars.size(), vars.data(), coeffs.data(), lhs, rhs) );
+        SCIP_CALL( SCIPaddCons(scip, constraint) );
+        SCIP_CALL( SCIPreleaseCons(scip, &constraint) );
+        return SCIP_OKAY;
+    };
+
+    //Constraint 1
+    for(auto & r : mrrg->routing_nodes)
+    {
+        std::vector<SCIP_VAR*> vars;
+        std::vector<SCIP_Real> coeffs;
+        for(auto & val : opgraph->val_nodes)
         {
-            std::vector<SCIP_VAR*> sum_of_fanins;
-            std::vector<SCIP_Real> coeff_sum_of_fanins;
-            int fanin_count = r->fanin.size();
-            if(fanin_count > 1)
+            if(SCIP_VAR* var = R_vars[val->id][r->id])
             {
-                for(auto &fanin : r->fanin)
-                {
-                    assert(fanin->type == MRRG_NODE_ROUTING);
+                vars.push_back(var);
+                coeffs.push_back(1.0);
+            }
+        }
 
-                    // TODO: Clean up this debug code
-                    if(fanin_count > 1)
-                    {
-                        if(fanin->fanout.size() != 1)
-                        {
+        // a single binary is always <= 1
+        if(vars.size() > 1)
+            SCIP_CALL( addLinear(ILP_NAME("route_exclusivity_" + std::to_string(r->id)), vars, coeffs, -SCIPinfinity(scip), 1.0) );
+    }
 
-                            std::cout << "Candidate MUX node is: " << *r << std::endl;
+    // Constraint 2
+    for(auto & f : mrrg->function_nodes)
+    {
+        std::vector<SCIP_VAR*> vars;
+        std::vector<SCIP_Real> coeffs;
+        for(auto & op : opgraph->op_nodes)
+        {
+            if(SCIP_VAR* var = F_vars[op->id][f->id])
+            {
+                vars.push_back(var);
+                coeffs.push_back(1.0);
+            }
+        }
 
-                            for(auto &print_fanins : r->fanin)
-                                std::cout << *print_fanins << "->" << *r << std::endl;
+        if(vars.size() > 1)
+            SCIP_CALL( addLinear(ILP_NAME("function_unit_exclusivity_" + std::to_string(f->id)), vars, coeffs, -SCIPinfinity(scip), 1.0) );
+    }
 
-                            std::cout << "Problem fanin is: " << *fanin << std::endl;
+    // Constraint 3
+    // an op without any legal function node leaves an empty constraint, making the problem infeasible
+    for(auto & op : opgraph->op_nodes)
+    {
+        std::vector<SCIP_VAR*> vars;
+        std::vector<SCIP_Real> coeffs;
+        for(auto & f : mrrg->function_nodes)
+        {
+            if(SCIP_VAR* var = F_vars[op->id][f->id])
+            {
+                vars.push_back(var);
+                coeffs.push_back(1.0);
+            }
+        }
 
-                            for(auto &print_fanouts : fanin->fanout)
-                                std::cout << *fanin << "->" << *print_fanouts << std::endl;
+        SCIP_CALL( addLinear(ILP_NAME("ensure_all_ops_mapped_" + std::to_string(op->id)), vars, coeffs, 1.0, 1.0) );
+    }
 
-                        }
-                        assert(fanin->fanout.size() == 1);
-                    }
+    // Constraint 4 - Fanout Routing
+    // with lazy_routing the rows are only added once violated, see enforceFanoutRouting()
+    if(!lazy_routing)
+    {
+        std::vector<SCIP_VAR*> sum_of_fanouts;
+        for(auto &val: opgraph->val_nodes)
+        {
+            for(auto &r: mrrg->routing_nodes)
+            {
+                int val_fanouts = val->output.size();
+                for(int i = 0; i < val_fanouts; i++)
+                {
+                    SCIP_VAR* sub_var = S_vars[val->id][i][r->id];
+                    if(!sub_var)
+                        continue;
+
+                    getFanoutRoutingVars(arch, val, i, r, S_vars, F_vars, sum_of_fanouts);
+                    std::vector<SCIP_Real> coeff_sum_of_fanouts(sum_of_fanouts.size(), 1.0);
+                    sum_of_fanouts.push_back(sub_var);
+                    coeff_sum_of_fanouts.push_back(-1.0);
+                    SCIP_CALL( addLinear(ILP_NAME("fanout_routing_" + std::to_string(val->id) + "_" + std::to_string(i) + "_" + std::to_string(r->id)), sum_of_fanouts, coeff_sum_of_fanouts, 0.0, SCIPinfinity(scip)) );
+                }
+            }
+        }
+    }
 
-                    sum_of_fanins.push_back(*(R_var_map[val][fanin]));
+    // MUX Exclusivity Constraint
+    for(auto &val: opgraph->val_nodes)
+    {
+        for(auto &r: arch.mux_nodes)
+        {
+            std::vector<SCIP_VAR*> sum_of_fanins;
+            std::vector<SCIP_Real> coeff_sum_of_fanins;
+            for(auto &fanin : r->fanin)
+            {
+                if(SCIP_VAR* var = R_vars[val->id][fanin->id])
+                {
+                    sum_of_fanins.push_back(var);
                     coeff_sum_of_fanins.push_back(1.0);
                 }
-                SCIP_CONS* constraint;
-                sum_of_fanins.push_back(*(R_var_map[val][r]));
+            }
+            if(SCIP_VAR* var = R_vars[val->id][r->id])
+            {
+                sum_of_fanins.push_back(var);
                 coeff_sum_of_fanins.push_back(-1.0);
-                SCIP_CALL( SCIPcreateConsBasicLinear(scip, &constraint, ("mux_exclusivity_" + std::to_string(constr_count++)).c_str(), sum_of_fanins.size(), &sum_of_fanins[0], &coeff_sum_of_fanins[0], 0.0, 0.0) );
-                SCIP_CALL( SCIPaddCons(scip, constraint) );
-                SCIP_CALL( SCIPreleaseCons(scip, &constraint) );
             }
+            if(!sum_of_fanins.empty())
+                SCIP_CALL( addLinear(ILP_NAME("mux_exclusivity_" + std::to_string(val->id) + "_" + std::to_string(r->id)), sum_of_fanins, coeff_sum_of_fanins, 0.0, 0.0) );
         }
     }
 
     // Constraint 5 - FU Fanout
     // XXX: this assumes single output nodes in both OpGraph and MRRG
-    constr_count = 0;
     for(auto &op: opgraph->op_nodes)
     {
+        if(!op->output)
+            continue;
+        OpGraphVal* val = op->output;
         for(auto &f: mrrg->function_nodes)
         {
-            if(op->output)
+            MRRGNode* r = arch.fu_output[f->id];
+            int val_fanouts = val->output.size();
+            for(int i = 0; i < val_fanouts; i++)
             {
-                OpGraphVal* val = op->output;
-                assert(f->fanout.size() == 1);
-                for(auto & r : f->fanout)
+                std::vector<SCIP_VAR*> var;
+                std::vector<SCIP_Real> coeff;
+                if(SCIP_VAR* f_var = F_vars[op->id][f->id])
                 {
-                    int val_fanouts = val->output.size();
-                    for(int i = 0; i < val_fanouts; i++)
-                    {
-                        SCIP_CONS* constraint;
-                        SCIP_VAR* var[2] = {*(F_var_map[op][f]), S_var_map[val][r][i]};
-                        SCIP_Real coeff[2] = {1, -1};
-                        SCIP_CALL( SCIPcreateConsBasicLinear(scip, &constraint, ("function_unit_fanout_" + std::to_string(constr_count++)).c_str(), 2, var, coeff, 0.0, 0.0) );
-                        SCIP_CALL( SCIPaddCons(scip, constraint) );
-                        SCIP_CALL( SCIPreleaseCons(scip, &constraint) );
-                    }
+                    var.push_back(f_var);
+                    coeff.push_back(1.0);
                 }
+                if(SCIP_VAR* s_var = S_vars[val->id][i][r->id])
+                {
+                    var.push_back(s_var);
+                    coeff.push_back(-1.0);
+                }
+                if(!var.empty())
+                    SCIP_CALL( addLinear(ILP_NAME("function_unit_fanout_" + std::to_string(op->id) + "_" + std::to_string(f->id) + "_" + std::to_string(i)), var, coeff, 0.0, 0.0) );
             }
         }
     }
 
     // Constraint 7 - FU supported Op legality
-    constr_count = 0;
-    for(auto &op: opgraph->op_nodes)
+    // ops have no F variable on the function nodes that do not support them, see pruneILPVars()
+
+    // Initial solution
+    if(start)
     {
-        for(auto &f: mrrg->function_nodes)
+        std::vector<SCIP_VAR*> start_vars;
+        if(getStartVars(*start, mrrg, opgraph, R_vars, S_vars, F_vars, start_vars))
         {
-            if(!f->canMapOp(op))
-            {
-                SCIP_CONS* constraint;
-                SCIP_Real coeff[1] = {1.0};
-                SCIP_CALL( SCIPcreateConsBasicLinear(scip, &constraint, ("op_support_" + std::to_string(constr_count++)).c_str(), 1, F_var_map[op][f], coeff, 0.0, 0.0) );
-                SCIP_CALL( SCIPaddCons(scip, constraint) );
-                SCIP_CALL( SCIPreleaseCons(scip, &constraint) );
-            }
+            SCIP_SOL* start_sol;
+            SCIP_Bool stored;
+            SCIP_CALL( SCIPcreateOrigSol(scip, &start_sol, NULL) );
+            for(auto & var : start_vars)
+                SCIP_CALL( SCIPsetSolVal(scip, start_sol, var, 1.0) );
+            SCIP_CALL( SCIPaddSolFree(scip, &start_sol, &stored) );
+            if(verbose)
+                std::cout << "[INFO] Warm Start Solution " << (stored ? "Accepted" : "Rejected") << std::endl;
         }
+        else
+            std::cout << "[WARNING] Warm Start Mapping Does Not Fit the ILP Model, Ignored" << std::endl;
     }
 
 #ifdef WRITE_PROB
@@ -507,6 +1246,52 @@ static SCIP_RETCODE scip_run_solver(ILPMapperStatus & mapperstatus, MRRG * mrrg,
     std::fclose(fp);
 #endif
 
+    if(lazy_routing)
+    {
+        // the constraint handler works on the transformed problem
+        SCIP_CALL( SCIPtransformProb(scip) );
+        lazy_data.arch = &arch;
+        lazy_data.opgraph = opgraph;
+        lazy_data.R_vars.resize(num_opgraph_nodes);
+        for(auto & val : opgraph->val_nodes)
+        {
+            for(auto & r : mrrg->routing_nodes)
+            {
+                if(SCIP_VAR* var = R_vars[val->id][r->id])
+                {
+                    SCIP_CALL( SCIPgetTransformedVar(scip, var, &var) );
+                    lazy_data.R_vars[val->id].push_back(std::make_pair(r, var));
+                }
+            }
+        }
+        lazy_data.S_vars = S_vars;
+        lazy_data.F_vars = F_vars;
+        for(auto & val_vars : lazy_data.S_vars)
+        {
+            for(auto & sub_vars : val_vars)
+            {
+                for(auto & var : sub_vars)
+                {
+                    if(var)
+                        SCIP_CALL( SCIPgetTransformedVar(scip, var, &var) );
+                }
+            }
+        }
+        for(auto & op_vars : lazy_data.F_vars)
+        {
+            for(auto & var : op_vars)
+            {
+                if(var)
+                    SCIP_CALL( SCIPgetTransformedVar(scip, var, &var) );
+            }
+        }
+
+        SCIP_CONS* lazy_cons;
+        SCIP_CALL( SCIPcreateCons(scip, &lazy_cons, "fanout_routing", lazy_conshdlr, NULL, FALSE, FALSE, TRUE, TRUE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE) );
+        SCIP_CALL( SCIPaddCons(scip, lazy_cons) );
+        SCIP_CALL( SCIPreleaseCons(scip, &lazy_cons) );
+    }
+
     SCIP_CALL( SCIPsolve(scip) ); // Solve the problem
 
     SCIP_Status status = SCIPgetStatus(scip);
@@ -532,98 +1317,423 @@ static SCIP_RETCODE scip_run_solver(ILPMapperStatus & mapperstatus, MRRG * mrrg,
         for(auto & val : opgraph->val_nodes)
             val->fanout_result.resize(val->output.size());
 
-// TODO:
-/*
-        // Detailed mapping
-        for(auto & val : opgraph->val_nodes)
+// TODO:
+/*
+        // Detailed mapping
+        for(auto & val : opgraph->val_nodes)
+        {
+            for(int fanout_id = 0; fanout_id < val->output.size(); ++fanout_id)
+            {
+                for(auto & r : mrrg->routing_nodes)
+                {
+                    if(SCIPgetSolVal(scip, sol, S_vars[val->id][fanout_id][r->id]) == 1.0)
+                    {
+                        val->fanout_result.at(fanout_id).push_back(r);
+                    }
+                }
+            }
+        }
+*/        
+        for(auto & val : opgraph->val_nodes)
+        {
+            for(auto & r : mrrg->routing_nodes)
+            {
+                SCIP_VAR* var = R_vars[val->id][r->id];
+                if(var && SCIPgetSolVal(scip, sol, var) == 1.0)
+                {
+                    mapping_result->mapMRRGNode(val, r);
+                }
+            }
+        }
+        for(auto & op : opgraph->op_nodes)
+        {
+            for(auto & f : mrrg->function_nodes)
+            {
+                SCIP_VAR* var = F_vars[op->id][f->id];
+                if(var && SCIPgetSolVal(scip, sol, var) == 1.0)
+                {
+                    mapping_result->mapMRRGNode(op, f);
+                }
+            }
+        }
+        mapperstatus = (status == SCIP_STATUS_OPTIMAL) ? ILPMapperStatus::OPTIMAL_FOUND : ILPMapperStatus::SUBOPTIMAL_FOUND;
+    }
+    else
+        mapperstatus = ILPMapperStatus::UNLISTED_STATUS;
+
+    for(auto & var : all_vars)
+    {
+        SCIP_CALL( SCIPreleaseVar(scip, &var) );
+    }
+
+    SCIP_CALL( SCIPfreeTransform(scip) );
+    SCIP_CALL( SCIPfree(&scip) );
+    return SCIP_OKAY;
+}
+
+ILPMapperStatus ILPMapper::SCIPMap(OpGraph* opgraph, const ILPArchTemplate & arch, Mapping* mapping_result, const std::map<OpGraphNode*, std::vector<MRRGNode*>>* start, OpGraphOp* anchor)
+{
+    ILPMapperStatus mapperstatus;
+
+    std::lock_guard<std::mutex> guard(scip_lock);
+    if(cancelled())
+        return ILPMapperStatus::INTERRUPTED;
+    SCIP_RETCODE retcode = scip_run_solver(mapperstatus, arch, opgraph, timelimit, scip_mipgap, scip_solnlimit, mapping_result, start, anchor, cancel_flag, lazy_routing, verbose);
+    if(retcode != SCIP_OKAY)
+        throw cgrame_mapper_error("SCIP Error Code: " + std::to_string(retcode));
+    return mapperstatus;
+}
+
+// Solves the placement ILP for any feasible placement, placement is indexed by OpGraphOp::id
+static SCIP_RETCODE scip_run_placement(ILPMapperStatus & mapperstatus, const ILPPlacementModel & model, OpGraph * opgraph, double timelimit, const std::atomic<bool>* cancel, bool verbose, std::vector<MRRGNode*> & placement)
+{
+    MRRG* mrrg = model.arch->mrrg;
+    SCIP* scip;
+    SCIP_CALL( SCIPcreate(&scip) );
+    SCIP_CALL( SCIPincludeDefaultPlugins(scip) );
+    if(!verbose)
+        SCIP_CALL( SCIPsetIntParam(scip, "display/verblevel", 0) );
+
+    // there is no objective, the first solution is taken
+    SCIP_CALL( SCIPsetIntParam(scip, "limits/solutions", 1) );
+    if(timelimit != 0.0)
+        SCIP_CALL( SCIPsetRealParam(scip, "limits/time", timelimit) );
+
+    SCIP_EventhdlrData cancel_data = {cancel};
+    if(cancel)
+        SCIP_CALL( includeCancelEventhdlr(scip, &cancel_data) );
+
+    SCIP_CALL( SCIPcreateProbBasic(scip, "cgrame_place") );
+
+    std::vector<std::vector<SCIP_VAR*>> F_vars(opgraph->op_nodes.size());
+    std::vector<SCIP_VAR*> all_vars;
+    for(auto & op : opgraph->op_nodes)
+    {
+        F_vars[op->id].assign(mrrg->function_nodes.size(), nullptr);
+        for(auto & f : mrrg->function_nodes)
+        {
+            if(!model.F[op->id][f->id])
+                continue;
+            SCIP_VAR* var;
+            SCIP_CALL( SCIPcreateVarBasic(scip, &var, ILP_NAME("F_" + std::to_string(op->id) + "_" + std::to_string(f->id)).c_str(), 0.0, 1.0, 0.0, SCIP_VARTYPE_BINARY) );
+            SCIP_CALL( SCIPaddVar(scip, var) );
+            all_vars.push_back(var);
+            F_vars[op->id][f->id] = var;
+        }
+    }
+
+    // adds sum(vars * coeffs) in [lhs, rhs]
+    auto addLinear = [&](const std::string & name, std::vector<SCIP_VAR*> & vars, std::vector<SCIP_Real> & coeffs, SCIP_Real lhs, SCIP_Real rhs) -> SCIP_RETCODE
+    {
+        SCIP_CONS* constraint;
+        SCIP_CALL( SCIPcreateConsBasicLinear(scip, &constraint, name.c_str(), vars.size(), vars.data(), coeffs.data(), lhs, rhs) );
+        SCIP_CALL( SCIPaddCons(scip, constraint) );
+        SCIP_CALL( SCIPreleaseCons(scip, &constraint) );
+        return SCIP_OKAY;
+    };
+
+    // Constraint 2
+    for(auto & f : mrrg->function_nodes)
+    {
+        std::vector<SCIP_VAR*> vars;
+        for(auto & op : opgraph->op_nodes)
+        {
+            if(SCIP_VAR* var = F_vars[op->id][f->id])
+                vars.push_back(var);
+        }
+        std::vector<SCIP_Real> coeffs(vars.size(), 1.0);
+        if(vars.size() > 1)
+            SCIP_CALL( addLinear(ILP_NAME("function_unit_exclusivity_" + std::to_string(f->id)), vars, coeffs, -SCIPinfinity(scip), 1.0) );
+    }
+
+    // Constraint 3
+    for(auto & op : opgraph->op_nodes)
+    {
+        std::vector<SCIP_VAR*> vars;
+        for(auto & f : mrrg->function_nodes)
+        {
+            if(SCIP_VAR* var = F_vars[op->id][f->id])
+                vars.push_back(var);
+        }
+        std::vector<SCIP_Real> coeffs(vars.size(), 1.0);
+        SCIP_CALL( addLinear(ILP_NAME("ensure_all_ops_mapped_" + std::to_string(op->id)), vars, coeffs, 1.0, 1.0) );
+    }
+
+    // Consumer support
+    for(auto & support : model.supports)
+    {
+        std::vector<SCIP_VAR*> vars;
+        for(auto & fu : support.consumer_fus)
+            vars.push_back(F_vars[support.consumer->id][fu->id]);
+        std::vector<SCIP_Real> coeffs(vars.size(), 1.0);
+        vars.push_back(F_vars[support.op->id][support.fu->id]);
+        coeffs.push_back(-1.0);
+        SCIP_CALL( addLinear(ILP_NAME("consumer_support_" + std::to_string(support.op->id) + "_" + std::to_string(support.fu->id) + "_" + std::to_string(support.consumer->id)), vars, coeffs, 0.0, SCIPinfinity(scip)) );
+    }
+
+    // No-good cuts
+    for(unsigned int c = 0; c < model.cuts.size(); c++)
+    {
+        std::vector<SCIP_VAR*> vars;
+        for(auto & op_placement : model.cuts[c])
+            vars.push_back(F_vars[op_placement.first->id][op_placement.second->id]);
+        std::vector<SCIP_Real> coeffs(vars.size(), 1.0);
+        SCIP_CALL( addLinear(ILP_NAME("no_good_" + std::to_string(c)), vars, coeffs, -SCIPinfinity(scip), vars.size() - 1.0) );
+    }
+
+    SCIP_CALL( SCIPsolve(scip) );
+
+    SCIP_Status status = SCIPgetStatus(scip);
+    if(status == SCIP_STATUS_INFEASIBLE)
+    {
+        mapperstatus = ILPMapperStatus::INFEASIBLE;
+    }
+    else if(status == SCIP_STATUS_TIMELIMIT)
+    {
+        mapperstatus = ILPMapperStatus::TIMEOUT;
+    }
+    else if(status == SCIP_STATUS_USERINTERRUPT)
+    {
+        mapperstatus = ILPMapperStatus::INTERRUPTED;
+    }
+    else if(status == SCIP_STATUS_OPTIMAL || status == SCIP_STATUS_SOLLIMIT)
+    {
+        SCIP_SOL * sol = SCIPgetBestSol(scip);
+        if(sol == nullptr)
+            throw cgrame_mapper_error("Unable to Get Solution After Solving");
+        placement.assign(opgraph->op_nodes.size(), nullptr);
+        for(auto & op : opgraph->op_nodes)
+        {
+            for(auto & f : mrrg->function_nodes)
+            {
+                SCIP_VAR* var = F_vars[op->id][f->id];
+                if(var && SCIPgetSolVal(scip, sol, var) > 0.5)
+                    placement[op->id] = f;
+            }
+        }
+        mapperstatus = ILPMapperStatus::SUBOPTIMAL_FOUND;
+    }
+    else
+        mapperstatus = ILPMapperStatus::UNLISTED_STATUS;
+
+    for(auto & var : all_vars)
+    {
+        SCIP_CALL( SCIPreleaseVar(scip, &var) );
+    }
+
+    SCIP_CALL( SCIPfreeTransform(scip) );
+    SCIP_CALL( SCIPfree(&scip) );
+    return SCIP_OKAY;
+}
+
+ILPMapperStatus ILPMapper::SCIPPlace(OpGraph* opgraph, const ILPPlacementModel & model, double timelimit, std::vector<MRRGNode*> & placement)
+{
+    ILPMapperStatus mapperstatus;
+
+    std::lock_guard<std::mutex> guard(scip_lock);
+    if(cancelled())
+        return ILPMapperStatus::INTERRUPTED;
+    SCIP_RETCODE retcode = scip_run_placement(mapperstatus, model, opgraph, timelimit, cancel_flag, verbose, placement);
+    if(retcode != SCIP_OKAY)
+        throw cgrame_mapper_error("SCIP Error Code: " + std::to_string(retcode));
+    return mapperstatus;
+}
+
+// Decomposed mapping: a placement is taken from the placement ILP and routed with the negotiated router.
+// If routing fails, no-good cuts exclude the placements of the ops around each val that could not be routed
+// or node that was left overused, and the ILP is solved again. A cut for an unroutable val is exact, but
+// one for congestion may exclude routable placements, so running out of placements is not a proof of
+// infeasibility.
+ILPMapperStatus ILPMapper::mapDecomposed(OpGraph* opgraph, const ILPArchTemplate & arch, Mapping* mapping_result, OpGraphOp* anchor)
+{
+    auto start_time = std::chrono::steady_clock::now();
+
+    ILPPlacementModel model;
+    buildPlacementModel(model, arch, opgraph, anchor, decomposed_max_distance);
+
+    NegotiatedRouter router(arch.mrrg, decomposed_router_iterations);
+    router.setVerbose(verbose);
+    std::vector<MRRGNode*> placement;
+    std::vector<char> in_cut(opgraph->op_nodes.size());
+    for(int round = 1; ; round++)
+    {
+        double remaining_time = 0.0;
+        if(timelimit != 0)
+        {
+            remaining_time = timelimit - std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            if(remaining_time <= 0.0)
+                return ILPMapperStatus::TIMEOUT;
+        }
+
+        ILPMapperStatus status = ILPMapperStatus::UNLISTED_STATUS;
+        switch(solvertype)
+        {
+            case ILPSolverType::SCIP:
+                status = SCIPPlace(opgraph, model, remaining_time, placement);
+                break;
+#ifdef USE_GUROBI
+            case ILPSolverType::Gurobi:
+                status = GurobiPlace(opgraph, model, remaining_time, placement);
+                break;
+#endif
+        }
+        if(status == ILPMapperStatus::INFEASIBLE && !model.cuts.empty() && verbose)
+            std::cout << "[INFO] No Routable Placement Left After " << model.cuts.size() << " No-Good Cuts" << std::endl;
+        if(status != ILPMapperStatus::SUBOPTIMAL_FOUND)
+            return status;
+        if(cancelled())
+            return ILPMapperStatus::INTERRUPTED;
+
+        bool routed = router.route(opgraph, placement);
+        if(verbose)
+            std::cout << "[INFO] Placement " << round << ": Routing " << (routed ? "Succeeded" : "Failed") << " After " << router.getIterations() << " Iterations" << std::endl;
+        if(routed)
         {
-            for(int fanout_id = 0; fanout_id < val->output.size(); ++fanout_id)
+            for(auto & node_mapping : router.getMapping(opgraph))
             {
-                for(auto & r : mrrg->routing_nodes)
-                {
-                    if(SCIPgetSolVal(scip, sol, S_var_map[val][r][fanout_id]) == 1.0)
-                    {
-                        val->fanout_result.at(fanout_id).push_back(r);
-                    }
-                }
+                for(auto & n : node_mapping.second)
+                    mapping_result->mapMRRGNode(node_mapping.first, n);
             }
+            return ILPMapperStatus::SUBOPTIMAL_FOUND;
         }
-*/        
-        for(auto & val : opgraph->val_nodes)
+
+        // an unroutable val excludes the placement of its producer and consumers, and each node left overused
+        // excludes the placement of the producers and consumers of the vals routed through it
+        std::vector<std::vector<OpGraphVal*>> conflicts;
+        if(OpGraphVal* val = router.getUnroutableVal())
+            conflicts.push_back(std::vector<OpGraphVal*>(1, val));
+        for(auto & n : router.getOverusedNodes())
         {
-            for(auto & r : mrrg->routing_nodes)
+            conflicts.push_back(std::vector<OpGraphVal*>());
+            for(auto & val : opgraph->val_nodes)
             {
-                if(SCIPgetSolVal(scip, sol, *R_var_map[val][r]) == 1.0)
-                {
-                    mapping_result->mapMRRGNode(val, r);
-                }
+                const std::vector<MRRGNode*> & route = router.getRoute(val);
+                if(std::find(route.begin(), route.end(), n) != route.end())
+                    conflicts.back().push_back(val);
             }
         }
-        for(auto & op : opgraph->op_nodes)
+
+        const unsigned int num_cuts = model.cuts.size();
+        for(auto & conflict : conflicts)
         {
-            for(auto & f : mrrg->function_nodes)
+            std::fill(in_cut.begin(), in_cut.end(), 0);
+            for(auto & val : conflict)
             {
-                if(SCIPgetSolVal(scip, sol, *F_var_map[op][f]) == 1.0)
-                {
-                    mapping_result->mapMRRGNode(op, f);
-                }
+                if(val->input)
+                    in_cut[val->input->id] = 1;
+                for(auto & op : val->output)
+                    in_cut[op->id] = 1;
+            }
+            std::vector<std::pair<OpGraphOp*, MRRGNode*>> cut;
+            for(auto & op : opgraph->op_nodes)
+            {
+                if(in_cut[op->id])
+                    cut.push_back(std::make_pair(op, placement[op->id]));
             }
+            // vals along the same path give the same cut
+            if(std::find(model.cuts.begin() + num_cuts, model.cuts.end(), cut) == model.cuts.end())
+                model.cuts.push_back(cut);
         }
-        mapperstatus = (status == SCIP_STATUS_OPTIMAL) ? ILPMapperStatus::OPTIMAL_FOUND : ILPMapperStatus::SUBOPTIMAL_FOUND;
-    }
-    else
-        mapperstatus = ILPMapperStatus::UNLISTED_STATUS;
-
-    for(int i = 0; i < count_R; ++i)
-    {
-        SCIP_CALL( SCIPreleaseVar(scip, &R[i]) );
-    }
-    delete[] R;
 
-    for(int i = 0; i < count_F; ++i)
-    {
-        SCIP_CALL( SCIPreleaseVar(scip, &F[i]) );
-    }
-    delete[] F;
-
-    for(auto & s : S)
-    {
-        if(s.second <= 1)
-            continue;
-        else
+        // nothing to blame, exclude the whole placement
+        if(model.cuts.size() == num_cuts)
         {
-            for(int i = 0; i < s.second; ++i)
-                SCIP_CALL( SCIPreleaseVar(scip, &s.first[i]) );
-            delete[] s.first;
+            std::vector<std::pair<OpGraphOp*, MRRGNode*>> cut;
+            for(auto & op : opgraph->op_nodes)
+                cut.push_back(std::make_pair(op, placement[op->id]));
+            model.cuts.push_back(cut);
         }
     }
-
-    SCIP_CALL( SCIPfreeTransform(scip) );
-    SCIP_CALL( SCIPfree(&scip) );
-    return SCIP_OKAY;
 }
 
-ILPMapperStatus ILPMapper::SCIPMap(OpGraph* opgraph, int II, Mapping* mapping_result)
+#ifdef USE_GUROBI
+// Callback of the Gurobi solve. Aborts once the II sweep cancels the attempt, and with lazy routing,
+// adds the rows of Constraint 4 that a new incumbent violates.
+class GurobiMapperCallback : public GRBCallback
 {
-    // Create mrrg
-    MRRG* mrrg = cgra->getMRRG(II).get();
+    public:
+        GurobiMapperCallback(const std::atomic<bool>* cancel) : cancel(cancel) {}
 
-    ILPMapperStatus mapperstatus;
+        void setLazyRouting(const ILPArchTemplate* arch, OpGraph* opgraph, const std::vector<std::vector<GRBVar*>>* R_vars,
+            const std::vector<std::vector<std::vector<GRBVar*>>>* S_vars, const std::vector<std::vector<GRBVar*>>* F_vars)
+        {
+            this->arch = arch;
+            this->opgraph = opgraph;
+            this->S_vars = S_vars;
+            this->F_vars = F_vars;
 
-    SCIP_RETCODE retcode = scip_run_solver(mapperstatus, mrrg, opgraph, timelimit, scip_mipgap, scip_solnlimit, mapping_result);
-    if(retcode != SCIP_OKAY)
-        throw cgrame_mapper_error("SCIP Error Code: " + std::to_string(retcode));
-    return mapperstatus;
-}
+            // indexed by OpGraphNode::id, like the variables
+            routing_vars.assign(opgraph->op_nodes.size() + opgraph->val_nodes.size(), std::vector<std::pair<MRRGNode*, GRBVar*>>());
+            for(auto & val : opgraph->val_nodes)
+            {
+                for(auto & r : arch->mrrg->routing_nodes)
+                {
+                    if(GRBVar* var = (*R_vars)[val->id][r->id])
+                        routing_vars[val->id].push_back(std::make_pair(r, var));
+                }
+            }
+        }
 
-#ifdef USE_GUROBI
-ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, int II, Mapping* mapping_result)
+    protected:
+        void callback()
+        {
+            if(cancel && *cancel)
+            {
+                abort();
+                return;
+            }
+            if(where != GRB_CB_MIPSOL || !arch)
+                return;
+
+            // only the nodes that a val is routed through, the S variables of the fanouts at a node are at most its R variable
+            std::vector<GRBVar*> fanout_vars;
+            for(auto & val : opgraph->val_nodes)
+            {
+                for(auto & routing : routing_vars[val->id])
+                {
+                    if(getSolution(*routing.second) < 0.5)
+                        continue;
+
+                    MRRGNode* r = routing.first;
+                    for(unsigned int i = 0; i < val->output.size(); i++)
+                    {
+                        GRBVar* sub_var = (*S_vars)[val->id][i][r->id];
+                        if(!sub_var || getSolution(*sub_var) < 0.5)
+                            continue;
+
+                        getFanoutRoutingVars(*arch, val, i, r, *S_vars, *F_vars, fanout_vars);
+                        GRBLinExpr sum_of_fanouts;
+                        double routed = 0.0;
+                        for(auto & var : fanout_vars)
+                        {
+                            sum_of_fanouts += *var;
+                            routed += getSolution(*var);
+                        }
+                        if(routed < 0.5)
+                            addLazy(sum_of_fanouts >= *sub_var);
+                    }
+                }
+            }
+        }
+
+    private:
+        const std::atomic<bool>* cancel;
+        const ILPArchTemplate* arch = nullptr;
+        OpGraph* opgraph = nullptr;
+        const std::vector<std::vector<std::vector<GRBVar*>>>* S_vars = nullptr;
+        const std::vector<std::vector<GRBVar*>>* F_vars = nullptr;
+        // the routing nodes that each val can use, with their R variables
+        std::vector<std::vector<std::pair<MRRGNode*, GRBVar*>>> routing_vars;
+};
+
+ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, const ILPArchTemplate & arch, Mapping* mapping_result, const std::map<OpGraphNode*, std::vector<MRRGNode*>>* start, OpGraphOp* anchor)
 {
-    // Create mrrg
-    MRRG* mrrg = cgra->getMRRG(II).get();
+    MRRG* mrrg = arch.mrrg;
 
     // Create gurobi instance
     GRBEnv env = GRBEnv();
+    if(!verbose)
+        env.set(GRB_IntParam_OutputFlag, 0);
     env.set(GRB_DoubleParam_MIPGap, grb_mipgap);
     if(timelimit != 0.0)
         env.set(GRB_DoubleParam_TimeLimit, timelimit);
@@ -645,67 +1755,49 @@ ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, int II, Mapping* mapping_
 
     try
     {
-        const int num_dfg_vals  = opgraph->val_nodes.size();
-        const int num_dfg_ops   = opgraph->op_nodes.size();
-        const int num_mrrg_r    = mrrg->routing_nodes.size();
-        const int num_mrrg_f    = mrrg->function_nodes.size();
-
-        // Create variables and map of variables to MRRG nodes
-        const int count_R = num_dfg_vals * num_mrrg_r;
-        std::unique_ptr<GRBVar> Runique(model.addVars(count_R, GRB_BINARY));
-        GRBVar * R = Runique.get();
-
-        const int count_F = num_dfg_ops * num_mrrg_f;
-        std::unique_ptr<GRBVar> Funique(model.addVars(count_F, GRB_BINARY));
-        GRBVar * F = Funique.get();
-
-        std::vector<std::pair<GRBVar *, int>> S; // Vector of VAR array and number of fanouts
-        for(auto & val : opgraph->val_nodes)
-        {
-            for(auto & r : mrrg->routing_nodes)
-            {
-                int num_fanouts = val->output.size();
-                if(num_fanouts > 1)
-                {
-                    S.emplace_back(std::make_pair(model.addVars(num_fanouts, GRB_BINARY), num_fanouts));
-                }
-                else
-                {
-                    S.emplace_back(std::make_pair(nullptr, num_fanouts));
-                }
-            }
-        }
-
-        // Integrate new variables
-        model.update();
-
-        std::map<OpGraphVal*, std::map<MRRGNode*, GRBVar*> > R_var_map;
-        std::map<OpGraphVal*, std::map<MRRGNode*, GRBVar*> > S_var_map;
-        std::map<OpGraphOp*,  std::map<MRRGNode*, GRBVar*> > F_var_map;
-
-        // Populate maps
-        int constr_count = 0;
+        // Only the variables that can be part of a legal mapping are created
+        ILPVarDomain domain;
+        pruneILPVars(domain, arch, opgraph, anchor);
+
+        // variables indexed by OpGraphNode::id and MRRGNode::id, nullptr where pruned
+        const unsigned int num_opgraph_nodes = opgraph->op_nodes.size() + opgraph->val_nodes.size();
+        std::vector<std::vector<GRBVar*>> R_vars(num_opgraph_nodes);
+        std::vector<std::vector<std::vector<GRBVar*>>> S_vars(num_opgraph_nodes); // per fanout, the R variable if there is one fanout
+        std::vector<std::vector<GRBVar*>> F_vars(num_opgraph_nodes);
+        std::deque<GRBVar> all_vars; // stable storage for the variables
+
+        // Create variables, the objective is the number of routing nodes used
         int j = 0;
         for(auto & val : opgraph->val_nodes)
         {
+            int num_fanouts = val->output.size();
+            std::vector<GRBVar*> & val_vars = R_vars[val->id];
+            std::vector<std::vector<GRBVar*>> & sub_vars = S_vars[val->id];
+            val_vars.assign(mrrg->getNumNodes(), nullptr);
+            sub_vars.assign(num_fanouts, std::vector<GRBVar*>(mrrg->getNumNodes(), nullptr));
+
             int i = 0;
             for(auto & r : mrrg->routing_nodes)
             {
-                R_var_map[val][r] = &R[j * num_mrrg_r + i];
-                R_var_map[val][r]->set(GRB_StringAttr_VarName, "R_" + std::to_string(j) + "_" + std::to_string(i));
-                auto temp_it = S.begin() + (j * num_mrrg_r + i);
-                if(temp_it->second > 1)
+                if(domain.R[val->id][r->id])
                 {
-                    S_var_map[val][r] = temp_it->first;
-                    for(int k = 0; k < val->output.size(); k++)
+                    all_vars.push_back(model.addVar(0.0, 1.0, 1.0, GRB_BINARY, ILP_NAME("R_" + std::to_string(j) + "_" + std::to_string(i))));
+                    GRBVar* var = &all_vars.back();
+                    val_vars[r->id] = var;
+
+                    if(num_fanouts > 1)
                     {
-                        S_var_map[val][r][k].set(GRB_StringAttr_VarName, "R_" + std::to_string(j) + "_" + std::to_string(i) + "_" + std::to_string(k));
-                        model.addConstr(*(R_var_map[val][r]) >= S_var_map[val][r][k], "sub_val" + std::to_string(constr_count++));
+                        for(int k = 0; k < num_fanouts; k++)
+                        {
+                            if(!domain.S[val->id][k][r->id])
+                                continue;
+
+                            all_vars.push_back(model.addVar(0.0, 1.0, 0.0, GRB_BINARY, ILP_NAME("R_" + std::to_string(j) + "_" + std::to_string(i) + "_" + std::to_string(k))));
+                            sub_vars[k][r->id] = &all_vars.back();
+                        }
                     }
-                }
-                else
-                {
-                    S_var_map[val][r] = R_var_map[val][r];
+                    else if(num_fanouts == 1)
+                        sub_vars[0][r->id] = var;
                 }
                 i++;
             }
@@ -714,87 +1806,97 @@ ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, int II, Mapping* mapping_
         int p = 0;
         for(auto & op : opgraph->op_nodes)
         {
+            std::vector<GRBVar*> & op_vars = F_vars[op->id];
+            op_vars.assign(mrrg->function_nodes.size(), nullptr);
+
             int q = 0;
             for(auto & f : mrrg->function_nodes)
             {
-                F_var_map[op][f] = &F[p * num_mrrg_f + q];
-                F_var_map[op][f]->set(GRB_StringAttr_VarName, "F_" + std::to_string(p) + "_" + std::to_string(q));
+                if(domain.F[op->id][f->id])
+                {
+                    all_vars.push_back(model.addVar(0.0, 1.0, 0.0, GRB_BINARY, ILP_NAME("F_" + std::to_string(p) + "_" + std::to_string(q))));
+                    op_vars[f->id] = &all_vars.back();
+                }
                 q++;
             }
             p++;
         }
 
-        // Create and Set objective
-        GRBLinExpr objective;
-        double coeffs[count_R];
-        for(int i = 0; i < count_R; i++)
+        if(verbose)
+            std::cout << "[INFO] ILP Variables: " << all_vars.size() << " (Dense Model: "
+                << (opgraph->val_nodes.size() * mrrg->routing_nodes.size() + opgraph->op_nodes.size() * mrrg->function_nodes.size()) << " R and F Variables)" << std::endl;
+
+        // Integrate new variables
+        model.set(GRB_IntAttr_ModelSense, GRB_MINIMIZE);
+        model.update();
+
+        for(auto & val : opgraph->val_nodes)
         {
-            coeffs[i] = 1.0;
+            if(val->output.size() <= 1)
+                continue;
+            for(auto & r : mrrg->routing_nodes)
+            {
+                for(unsigned int k = 0; k < val->output.size(); k++)
+                {
+                    if(GRBVar* sub_var = S_vars[val->id][k][r->id])
+                        model.addConstr(*R_vars[val->id][r->id] >= *sub_var, ILP_NAME("sub_val_" + std::to_string(val->id) + "_" + std::to_string(r->id) + "_" + std::to_string(k)));
+                }
+            }
         }
 
-        objective.addTerms(coeffs, R, count_R);
-        model.setObjective(objective, GRB_MINIMIZE);
-
         // Constraint 1 - Route Exclusivity
-        constr_count = 0;
-        for(int i = 0; i < num_mrrg_r; i++)
+        for(auto & r : mrrg->routing_nodes)
         {
             GRBLinExpr constraint;
-            double coeffs[num_dfg_vals];
-            GRBVar vars [num_dfg_vals];
-
-            for(int j = 0; j < num_dfg_vals; j++)
+            int num_terms = 0;
+            for(auto & val : opgraph->val_nodes)
             {
-                coeffs[j] = 1.0;
-                vars[j] = R[j * num_mrrg_r + i];
+                if(GRBVar* var = R_vars[val->id][r->id])
+                {
+                    constraint += *var;
+                    num_terms++;
+                }
             }
 
-            constraint.addTerms(coeffs, vars, num_dfg_vals);
-
-            model.addConstr(constraint <= 1,"route_exclusivity_" + std::to_string(constr_count++));
+            // a single binary is always <= 1
+            if(num_terms > 1)
+                model.addConstr(constraint <= 1, ILP_NAME("route_exclusivity_" + std::to_string(r->id)));
         }
 
         // Constraint 2
-        constr_count = 0;
-        for(int p = 0; p < num_mrrg_f; p++)
+        for(auto & f : mrrg->function_nodes)
         {
             GRBLinExpr constraint;
-            double coeffs[num_dfg_ops];
-            GRBVar vars [num_dfg_ops];
-
-            for(int q = 0; q < num_dfg_ops; q++)
+            int num_terms = 0;
+            for(auto & op : opgraph->op_nodes)
             {
-                coeffs[q] = 1.0;
-                vars[q] = F[q * num_mrrg_f + p];
+                if(GRBVar* var = F_vars[op->id][f->id])
+                {
+                    constraint += *var;
+                    num_terms++;
+                }
             }
 
-            constraint.addTerms(coeffs, vars, num_dfg_ops);
-
-            model.addConstr(constraint <= 1, "function_unit_exclusivity_" + std::to_string(constr_count++));
+            if(num_terms > 1)
+                model.addConstr(constraint <= 1, ILP_NAME("function_unit_exclusivity_" + std::to_string(f->id)));
         }
 
         // Constraint 3
-        constr_count = 0;
-        for(int q = 0; q < num_dfg_ops; q++)
+        // an op without any legal function node leaves an empty constraint, making the problem infeasible
+        for(auto & op : opgraph->op_nodes)
         {
             GRBLinExpr constraint;
-            double coeffs[num_mrrg_f];
-            GRBVar vars [num_mrrg_f];
-
-            for(int p = 0; p < num_mrrg_f; p++)
+            for(auto & f : mrrg->function_nodes)
             {
-                coeffs[p] = 1.0;
-                vars[p] = F[q * num_mrrg_f + p];
+                if(GRBVar* var = F_vars[op->id][f->id])
+                    constraint += *var;
             }
 
-            constraint.addTerms(coeffs, vars, num_mrrg_f);
-
-            model.addConstr(constraint == 1, "ensure_all_ops_mapped_" + std::to_string(constr_count++));
+            model.addConstr(constraint == 1, ILP_NAME("ensure_all_ops_mapped_" + std::to_string(op->id)));
         }
 
         // Constraint 4 - Fanout Routing
-        int constr_count1 = 0;
-        int constr_count2 = 0;
+        std::vector<GRBVar*> fanout_vars;
         for(auto &val: opgraph->val_nodes)
         {
             for(auto &r: mrrg->routing_nodes)
@@ -802,65 +1904,31 @@ ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, int II, Mapping* mapping_
                 int val_fanouts = val->output.size();
                 for(int i = 0; i < val_fanouts; i++)
                 {
-                    GRBLinExpr sum_of_fanouts;
-                    int fanout_count = 0;
-                    for(auto &mrrg_fanout : r->fanout)
+                    GRBVar* sub_var = S_vars[val->id][i][r->id];
+                    if(!sub_var)
+                        continue;
+
+                    // with lazy_routing the rows are only added once violated, see GurobiMapperCallback
+                    if(!lazy_routing)
                     {
-                        if(mrrg_fanout->type == MRRG_NODE_ROUTING)
-                        {
-                            sum_of_fanouts += S_var_map[val][mrrg_fanout][i];
-                            fanout_count++;
-                        }
-                        else if(mrrg_fanout->type == MRRG_NODE_FUNCTION)
-                        {
-                            auto &op =  val->output[i];
-                            int operand = val->output_operand[i];
-
-                            if(mrrg_fanout->fanin.size() > operand && mrrg_fanout->fanin[operand] == r)
-                            {
-                                sum_of_fanouts += *(F_var_map[op][mrrg_fanout]);
-                                fanout_count++;
-                            }
-                        }
-                        else
-                        {
-                            assert(0);
-                        }
-                    }
+                        getFanoutRoutingVars(arch, val, i, r, S_vars, F_vars, fanout_vars);
+                        GRBLinExpr sum_of_fanouts;
+                        for(auto &var : fanout_vars)
+                            sum_of_fanouts += *var;
 
-                    model.addConstr(sum_of_fanouts >= S_var_map[val][r][i], "fanout_routing_" + std::to_string(constr_count1++));
+                        model.addConstr(sum_of_fanouts >= *sub_var, ILP_NAME("fanout_routing_" + std::to_string(val->id) + "_" + std::to_string(i) + "_" + std::to_string(r->id)));
+                    }
 
 #ifdef CONSTRAIN_S_VALS
                     GRBLinExpr sum_of_fanins;
-                    int fanin_count = r->fanin.size();
-                    if(fanin_count > 1)
+                    if(r->fanin.size() > 1)
                     {
                         for(auto &fanin : r->fanin)
                         {
-                            assert(fanin->type == MRRG_NODE_ROUTING);
-                            // TODO: Clean up this debug code
-                            if(fanin_count > 1)
-                            {
-                                if(fanin->fanout.size() != 1)
-                                {
-
-                                    std::cout << "Candidate MUX node is: " << *r << std::endl;
-
-                                    for(auto &print_fanins : r->fanin)
-                                        std::cout << *print_fanins << "->" << *r << std::endl;
-
-                                    std::cout << "Problem fanin is: " << *fanin << std::endl;
-
-                                    for(auto &print_fanouts : fanin->fanout)
-                                        std::cout << *fanin << "->" << *print_fanouts << std::endl;
-
-                                }
-                                assert(fanin->fanout.size() == 1);
-                            }
-
-                            sum_of_fanins += S_var_map[val][fanin][i];
+                            if(GRBVar* var = S_vars[val->id][i][fanin->id])
+                                sum_of_fanins += *var;
                         }
-                        model.addConstr(sum_of_fanins == S_var_map[val][r][i], "mux_exclusivity_" + std::to_string(constr_count2++));
+                        model.addConstr(sum_of_fanins == *sub_var, ILP_NAME("mux_exclusivity_" + std::to_string(val->id) + "_" + std::to_string(i) + "_" + std::to_string(r->id)));
                     }
 #endif
                 }
@@ -868,77 +1936,70 @@ ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, int II, Mapping* mapping_
         }
 
 #ifndef CONSTRAIN_S_VALS
-        constr_count = 0;
         for(auto &val: opgraph->val_nodes)
         {
-            for(auto &r: mrrg->routing_nodes)
+            for(auto &r: arch.mux_nodes)
             {
                 GRBLinExpr sum_of_fanins;
-                int fanin_count = r->fanin.size();
-                if(fanin_count > 1)
+                int num_terms = 0;
+                for(auto &fanin : r->fanin)
                 {
-                    for(auto &fanin : r->fanin)
+                    if(GRBVar* var = R_vars[val->id][fanin->id])
                     {
-                        assert(fanin->type == MRRG_NODE_ROUTING);
-                        // TODO: Clean up this debug code
-                        if(fanin_count > 1)
-                        {
-                            if(fanin->fanout.size() != 1)
-                            {
-
-                                std::cout << "Candidate MUX node is: " << *r << std::endl;
-
-                                for(auto &print_fanins : r->fanin)
-                                    std::cout << *print_fanins << "->" << *r << std::endl;
-
-                                std::cout << "Problem fanin is: " << *fanin << std::endl;
-
-                                for(auto &print_fanouts : fanin->fanout)
-                                    std::cout << *fanin << "->" << *print_fanouts << std::endl;
-
-                            }
-                            assert(fanin->fanout.size() == 1);
-                        }
-
-                        sum_of_fanins += *(R_var_map[val][fanin]);
+                        sum_of_fanins += *var;
+                        num_terms++;
                     }
-                    model.addConstr(sum_of_fanins == *(R_var_map[val][r]), "mux_exclusivity_" + std::to_string(constr_count++));
                 }
+                GRBLinExpr target;
+                if(GRBVar* var = R_vars[val->id][r->id])
+                {
+                    target += *var;
+                    num_terms++;
+                }
+                if(num_terms > 0)
+                    model.addConstr(sum_of_fanins == target, ILP_NAME("mux_exclusivity_" + std::to_string(val->id) + "_" + std::to_string(r->id)));
             }
         }
 #endif
 
         // Constraint 5 - FU Fanout
         // XXX: this assumes single output nodes in both OpGraph and MRRG
-        constr_count = 0;
         for(auto &op: opgraph->op_nodes)
         {
+            if(!op->output)
+                continue;
+            OpGraphVal* val = op->output;
             for(auto &f: mrrg->function_nodes)
             {
-                if(op->output)
+                MRRGNode* r = arch.fu_output[f->id];
+                int val_fanouts = val->output.size();
+                for(int i = 0; i < val_fanouts; i++)
                 {
-                    OpGraphVal* val = op->output;
-                    assert(f->fanout.size() == 1);
-                    for(auto & r : f->fanout)
-                    {
-                        int val_fanouts = val->output.size();
-                        for(int i = 0; i < val_fanouts; i++)
-                        {
-                            model.addConstr(*(F_var_map[op][f]) == S_var_map[val][r][i], "function_unit_fanout_" + std::to_string(constr_count++));
-                        }
-                    }
+                    GRBVar* f_var = F_vars[op->id][f->id];
+                    GRBVar* s_var = S_vars[val->id][i][r->id];
+                    if(!f_var && !s_var)
+                        continue;
+                    model.addConstr((f_var ? GRBLinExpr(*f_var) : GRBLinExpr()) == (s_var ? GRBLinExpr(*s_var) : GRBLinExpr()), ILP_NAME("function_unit_fanout_" + std::to_string(op->id) + "_" + std::to_string(f->id) + "_" + std::to_string(i)));
                 }
             }
         }
 
         // Constraint 7 - FU supported Op legality
-        for(auto &op: opgraph->op_nodes)
+        // ops have no F variable on the function nodes that do not support them, see pruneILPVars()
+
+        // Initial solution, the MIP start of all other variables is 0
+        if(start)
         {
-            for(auto &f: mrrg->function_nodes)
+            std::vector<GRBVar*> start_vars;
+            if(getStartVars(*start, mrrg, opgraph, R_vars, S_vars, F_vars, start_vars))
             {
-                if(!f->canMapOp(op))
-                    model.addConstr(*(F_var_map[op][f]) == 0, "op_support_" + std::to_string(constr_count++));
+                for(auto & var : all_vars)
+                    var.set(GRB_DoubleAttr_Start, 0.0);
+                for(auto & var : start_vars)
+                    var->set(GRB_DoubleAttr_Start, 1.0);
             }
+            else
+                std::cout << "[WARNING] Warm Start Mapping Does Not Fit the ILP Model, Ignored" << std::endl;
         }
 
         // Update all of the constraints and variables in the model
@@ -948,10 +2009,20 @@ ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, int II, Mapping* mapping_
         model.write("Gurobi_Problem.lp");
 #endif
 
+        GurobiMapperCallback callback(cancel_flag);
+        if(lazy_routing)
+        {
+            model.set(GRB_IntParam_LazyConstraints, 1);
+            callback.setLazyRouting(&arch, opgraph, &R_vars, &S_vars, &F_vars);
+        }
+        if(cancel_flag || lazy_routing)
+            model.setCallback(&callback);
+
         // Optimize model
         model.optimize();
         double ilp_runtime = model.get(GRB_DoubleAttr_Runtime);
-        std::cout << "Gurobi Runtime: " << ilp_runtime << std::endl;
+        if(verbose)
+            std::cout << "Gurobi Runtime: " << ilp_runtime << std::endl;
 
         int status = model.get(GRB_IntAttr_Status);
         if(status == GRB_INFEASIBLE)
@@ -984,7 +2055,7 @@ ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, int II, Mapping* mapping_
                 {
                     for(auto & r : mrrg->routing_nodes)
                     {
-                        if(S_var_map[val][r][fanout_id].get(GRB_DoubleAttr_X) == 1.0)
+                        if(S_vars[val->id][fanout_id][r->id]->get(GRB_DoubleAttr_X) == 1.0)
                         {
                             val->fanout_result.at(fanout_id).push_back(r);
                         }
@@ -996,7 +2067,8 @@ ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, int II, Mapping* mapping_
             {
                 for(auto & r : mrrg->routing_nodes)
                 {
-                    if(R_var_map[val][r]->get(GRB_DoubleAttr_X) == 1.0)
+                    GRBVar* var = R_vars[val->id][r->id];
+                    if(var && var->get(GRB_DoubleAttr_X) == 1.0)
                     {
                         mapping_result->mapMRRGNode(val, r);
                     }
@@ -1006,7 +2078,8 @@ ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, int II, Mapping* mapping_
             {
                 for(auto & f : mrrg->function_nodes)
                 {
-                    if(F_var_map[op][f]->get(GRB_DoubleAttr_X) == 1.0)
+                    GRBVar* var = F_vars[op->id][f->id];
+                    if(var && var->get(GRB_DoubleAttr_X) == 1.0)
                     {
                         mapping_result->mapMRRGNode(op, f);
                     }
@@ -1026,5 +2099,126 @@ ILPMapperStatus ILPMapper::GurobiMap(OpGraph* opgraph, int II, Mapping* mapping_
         throw cgrame_mapper_error("Gurobi Unknown Exception During Mapper");
     }
 }
+
+// Solves the placement ILP for any feasible placement, placement is indexed by OpGraphOp::id
+ILPMapperStatus ILPMapper::GurobiPlace(OpGraph* opgraph, const ILPPlacementModel & placement_model, double timelimit, std::vector<MRRGNode*> & placement)
+{
+    MRRG* mrrg = placement_model.arch->mrrg;
+
+    // there is no objective, the first solution is taken
+    GRBEnv env = GRBEnv();
+    if(!verbose)
+        env.set(GRB_IntParam_OutputFlag, 0);
+    env.set(GRB_IntParam_SolutionLimit, 1);
+    if(timelimit != 0.0)
+        env.set(GRB_DoubleParam_TimeLimit, timelimit);
+    GRBModel model = GRBModel(env);
+
+    try
+    {
+        std::vector<std::vector<GRBVar*>> F_vars(opgraph->op_nodes.size());
+        std::deque<GRBVar> all_vars; // stable storage for the variables
+        for(auto & op : opgraph->op_nodes)
+        {
+            F_vars[op->id].assign(mrrg->function_nodes.size(), nullptr);
+            for(auto & f : mrrg->function_nodes)
+            {
+                if(!placement_model.F[op->id][f->id])
+                    continue;
+                all_vars.push_back(model.addVar(0.0, 1.0, 0.0, GRB_BINARY, ILP_NAME("F_" + std::to_string(op->id) + "_" + std::to_string(f->id))));
+                F_vars[op->id][f->id] = &all_vars.back();
+            }
+        }
+
+        // Constraint 2
+        for(auto & f : mrrg->function_nodes)
+        {
+            GRBLinExpr sum_of_ops;
+            for(auto & op : opgraph->op_nodes)
+            {
+                if(GRBVar* var = F_vars[op->id][f->id])
+                    sum_of_ops += *var;
+            }
+            if(sum_of_ops.size() > 1)
+                model.addConstr(sum_of_ops <= 1, ILP_NAME("function_unit_exclusivity_" + std::to_string(f->id)));
+        }
+
+        // Constraint 3
+        for(auto & op : opgraph->op_nodes)
+        {
+            GRBLinExpr sum_of_fus;
+            for(auto & f : mrrg->function_nodes)
+            {
+                if(GRBVar* var = F_vars[op->id][f->id])
+                    sum_of_fus += *var;
+            }
+            model.addConstr(sum_of_fus == 1, ILP_NAME("ensure_all_ops_mapped_" + std::to_string(op->id)));
+        }
+
+        // Consumer support
+        for(auto & support : placement_model.supports)
+        {
+            GRBLinExpr sum_of_consumers;
+            for(auto & fu : support.consumer_fus)
+                sum_of_consumers += *F_vars[support.consumer->id][fu->id];
+            model.addConstr(sum_of_consumers >= *F_vars[support.op->id][support.fu->id], ILP_NAME("consumer_support_" + std::to_string(support.op->id) + "_" + std::to_string(support.fu->id) + "_" + std::to_string(support.consumer->id)));
+        }
+
+        // No-good cuts
+        for(unsigned int c = 0; c < placement_model.cuts.size(); c++)
+        {
+            GRBLinExpr sum_of_placements;
+            for(auto & op_placement : placement_model.cuts[c])
+                sum_of_placements += *F_vars[op_placement.first->id][op_placement.second->id];
+            model.addConstr(sum_of_placements <= placement_model.cuts[c].size() - 1.0, ILP_NAME("no_good_" + std::to_string(c)));
+        }
+
+        model.update();
+
+        GurobiMapperCallback callback(cancel_flag);
+        if(cancel_flag)
+            model.setCallback(&callback);
+
+        model.optimize();
+
+        int status = model.get(GRB_IntAttr_Status);
+        if(status == GRB_INFEASIBLE)
+        {
+            return ILPMapperStatus::INFEASIBLE;
+        }
+        else if(status == GRB_TIME_LIMIT)
+        {
+            return ILPMapperStatus::TIMEOUT;
+        }
+        else if(status == GRB_INTERRUPTED)
+        {
+            return ILPMapperStatus::INTERRUPTED;
+        }
+        else if(status == GRB_OPTIMAL || status == GRB_SUBOPTIMAL || status == GRB_SOLUTION_LIMIT)
+        {
+            placement.assign(opgraph->op_nodes.size(), nullptr);
+            for(auto & op : opgraph->op_nodes)
+            {
+                for(auto & f : mrrg->function_nodes)
+                {
+                    GRBVar* var = F_vars[op->id][f->id];
+                    if(var && var->get(GRB_DoubleAttr_X) > 0.5)
+                        placement[op->id] = f;
+                }
+            }
+            return ILPMapperStatus::SUBOPTIMAL_FOUND;
+        }
+        else
+            return ILPMapperStatus::UNLISTED_STATUS;
+    }
+    catch(GRBException e)
+    {
+        throw cgrame_mapper_error("Gurobi Error Code: " + std::to_string(e.getErrorCode()) + " Message: " + std::string(e.getMessage()));
+    }
+    catch(...)
+    {
+        throw cgrame_mapper_error("Gurobi Unknown Exception During Mapper");
+    }
+}
 #endif
 
@@ -166,11 +166,87 @@ void MRRG::finalize()
         }
     }
 
-    // For all Function unit nodes, find neighbours nodes
+    // Assign dense ids, function nodes first followed by the routing nodes
+    unsigned int id = 0;
+    for(auto &f : function_nodes)
+        f->id = id++;
+    for(auto &r : routing_nodes)
+        r->id = id++;
+
+    // Build the supported op masks and the per opcode index of function nodes
+    static_assert(OPGRAPH_OP_NUM_OPCODES <= 8 * sizeof(unsigned int), "supported_ops_mask is too small for all opcodes");
+    function_nodes_by_opcode.assign(OPGRAPH_OP_NUM_OPCODES, std::vector<MRRGNode*>());
+    for(auto &f : function_nodes)
+    {
+        f->supported_ops_mask = 0;
+        for(auto &opcode : f->supported_ops)
+        {
+            if(!(f->supported_ops_mask & (1u << opcode)))
+                function_nodes_by_opcode[opcode].push_back(f);
+            f->supported_ops_mask |= 1u << opcode;
+        }
+    }
+
+    // For all Function unit nodes, find neighbours nodes, sorted by distance
     for(auto &f : function_nodes)
     {
         f->neighbourFUs = findNeighbourFUs(f);
+        std::stable_sort(f->neighbourFUs.begin(), f->neighbourFUs.end(),
+            [](const std::pair<MRRGNode*, int>& a, const std::pair<MRRGNode*, int>& b) { return a.second < b.second; });
+    }
+
+    // the lookahead is rebuilt on the next query
+    lookahead.clear();
+    lookahead_row.clear();
+    lookahead_built = false;
+}
+
+const unsigned short MRRG::LOOKAHEAD_UNREACHABLE;
+
+// For every function node, do a reverse BFS from its operands to find the distance from
+// all nodes that can reach it. Only routing nodes are expanded as routes can't pass through FUs.
+void MRRG::buildLookahead() const
+{
+    std::lock_guard<std::mutex> lock(lookahead_mutex);
+    if(lookahead_built)
+        return;
+
+    unsigned int num_nodes = getNumNodes();
+
+    lookahead.assign(function_nodes.size(), std::vector<unsigned short>());
+    lookahead_row.assign(num_nodes, 0);
+
+    std::queue<MRRGNode*> to_visit;
+    for(auto &f : function_nodes)
+    {
+        std::vector<unsigned short>& dist = lookahead[f->id];
+        dist.assign(num_nodes, LOOKAHEAD_UNREACHABLE);
+
+        for(auto &o : f->operand)
+        {
+            lookahead_row[o.second->id] = f->id;
+            dist[o.second->id] = 0;
+            to_visit.push(o.second);
+        }
+
+        while(!to_visit.empty())
+        {
+            MRRGNode* n = to_visit.front();
+            to_visit.pop();
+
+            for(auto const &prev : n->fanin)
+            {
+                if(dist[prev->id] == LOOKAHEAD_UNREACHABLE)
+                {
+                    dist[prev->id] = std::min(dist[n->id] + 1, LOOKAHEAD_UNREACHABLE - 1);
+                    if(prev->type == MRRG_NODE_ROUTING)
+                        to_visit.push(prev);
+                }
+            }
+        }
     }
+
+    lookahead_built.store(true, std::memory_order_release);
 }
 
 static void print_subcluster(std::map<std::string, std::string> & clusters, std::string current_cluster)
@@ -245,11 +321,12 @@ MRRGNode::MRRGNode(Module* parent, unsigned int cycle, std::string name, MRRGNod
     //this->occupancy = 0;
     this->parent = parent;
     this->pt = UNSPECIFIED;
-    this->prev = NULL;
     this->min_latency = 0;
     this->max_latency = 0;
     this->latency = 0;
     this->delay = 0;
+    this->id = 0;
+    this->supported_ops_mask = 0;
 
     if(type == MRRG_NODE_FUNCTION)
         this->essential = true;
@@ -267,14 +344,10 @@ float MRRGNode::getCost(float penalty_factor)
 }
 
 */
+// NB: relies on supported_ops_mask, so the MRRG must be finalized
 bool MRRGNode::canMapOp(OpGraphOp const * op)
 {
-    FORALL(f, supported_ops)
-    {
-        if(op->opcode == *f)
-            return true;
-    }
-    return false;
+    return supported_ops_mask & (1u << op->opcode);
 }
 
 
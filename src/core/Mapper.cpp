@@ -30,6 +30,12 @@
  * CGRA-ME framework.
  ******************************************************************************/
 
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <exception>
+#include <tuple>
+
 #include <CGRA/CGRA.h>
 
 #include <CGRA/Mapper.h>
@@ -61,18 +67,277 @@ Mapper::~Mapper()
 {
 }
 
-Mapping Mapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph)
+// ResMII only checks every set of opcodes if the OpGraph has at most this many opcodes, otherwise each
+// opcode on its own and all of them together
+#define RESMII_MAX_SUBSET_OPCODES 16
+
+// Resource constrained minimum II: the lowest II at which, for every set of opcodes in the OpGraph, the
+// function nodes that support one of them are at least as many as the ops with one of them (Hall's
+// condition for placing each op on a node of its own). Returns cgra->maxII + 1 if no II up to maxII has enough.
+int Mapper::getResMII(OpGraph* opgraph)
 {
-    int ii = 1;
-    bool mapped = false;
-    Mapping result(cgra, ii, opgraph);
-    while(ii <= cgra->maxII)
+    // the opcodes in the OpGraph, numbered by first use
+    std::vector<int> opcode_index(OPGRAPH_OP_NUM_OPCODES, -1);
+    std::vector<int> op_count;
+    for(auto & op : opgraph->op_nodes)
     {
-        result  =  mapOpGraph(opgraph, ii);
-        if(result.isMapped())
-            return result;        
+        if(opcode_index[op->opcode] < 0)
+        {
+            opcode_index[op->opcode] = op_count.size();
+            op_count.push_back(0);
+        }
+        op_count[opcode_index[op->opcode]]++;
     }
 
-    return result;
+    const int num_opcodes = op_count.size();
+    std::vector<unsigned int> subsets;
+    if(num_opcodes <= RESMII_MAX_SUBSET_OPCODES)
+    {
+        for(unsigned int subset = 1; subset < (1u << num_opcodes); subset++)
+            subsets.push_back(subset);
+    }
+    else
+    {
+        for(int k = 0; k < num_opcodes; k++)
+            subsets.push_back(1u << k);
+        subsets.push_back(~0u);
+    }
+
+    for(int II = 1; II <= cgra->maxII; II++)
+    {
+        // function nodes by the opcodes of the OpGraph that they support
+        std::map<unsigned int, int> fu_count;
+        for(auto & f : cgra->getMRRG(II)->function_nodes)
+        {
+            unsigned int supported = 0;
+            for(int opcode = 0; opcode < OPGRAPH_OP_NUM_OPCODES; opcode++)
+            {
+                if(opcode_index[opcode] >= 0 && (f->supported_ops_mask & (1u << opcode)))
+                    supported |= 1u << opcode_index[opcode];
+            }
+            fu_count[supported]++;
+        }
+
+        bool enough = true;
+        for(unsigned int subset : subsets)
+        {
+            int ops = 0;
+            for(int k = 0; k < num_opcodes; k++)
+            {
+                if(subset & (1u << k))
+                    ops += op_count[k];
+            }
+            int fus = 0;
+            for(auto & count : fu_count)
+            {
+                if(count.first & subset)
+                    fus += count.second;
+            }
+            if(fus < ops)
+            {
+                enough = false;
+                break;
+            }
+        }
+        if(enough)
+            return II;
+    }
+    return cgra->maxII + 1;
 }
 
+// Marks the DFS back edges from op, as a list of (producer, consumer) op ids
+static void findBackEdges(OpGraphOp* op, std::vector<int> & dfs_colour, std::vector<std::pair<int, int>> & back_edges)
+{
+    // 0 - white, 1 - grey, 2 - black, as in OpGraph::getMaxCycle()
+    dfs_colour[op->id] = 1;
+    if(op->output)
+    {
+        for(auto & n : op->output->output)
+        {
+            if(dfs_colour[n->id] == 0)
+                findBackEdges(n, dfs_colour, back_edges);
+            else if(dfs_colour[n->id] == 1)
+                back_edges.push_back(std::make_pair(op->id, n->id));
+        }
+    }
+    dfs_colour[op->id] = 2;
+}
+
+// Recurrence constrained minimum II. The OpGraph has no iteration distances, so each DFS back edge is taken
+// as a dependence on the previous iteration, and each op takes the lowest latency of the function nodes that
+// support it. The II is the lowest at which no cycle has more latency than II times its distance.
+// This is a placeholder: the function nodes of the current modules all have a latency of 0, so it is always 1.
+// Register latency along the routes is left out on purpose: the MRRG only needs the latency around a cycle to be
+// a multiple of the II, so without iteration distances in the OpGraph it would not bound the II of the mapper.
+int Mapper::getRecMII(OpGraph* opgraph)
+{
+    MRRG* mrrg = cgra->getMRRG(1).get();
+    const int num_ops = opgraph->op_nodes.size();
+
+    std::vector<int> latency(num_ops, 0);
+    int total_latency = 0;
+    for(auto & op : opgraph->op_nodes)
+    {
+        bool found = false;
+        for(auto & f : mrrg->function_nodes)
+        {
+            if(f->canMapOp(op) && (!found || (int)f->latency < latency[op->id]))
+            {
+                latency[op->id] = f->latency;
+                found = true;
+            }
+        }
+        total_latency += latency[op->id];
+    }
+
+    std::vector<int> dfs_colour(num_ops, 0);
+    std::vector<std::pair<int, int>> back_edges;
+    for(auto & op : opgraph->op_nodes)
+    {
+        if(dfs_colour[op->id] == 0)
+            findBackEdges(op, dfs_colour, back_edges);
+    }
+    if(back_edges.empty())
+        return 1;
+
+    // edges (producer, consumer, distance)
+    std::vector<std::tuple<int, int, int>> edges;
+    for(auto & val : opgraph->val_nodes)
+    {
+        if(!val->input)
+            continue;
+        for(auto & op : val->output)
+        {
+            int distance = std::count(back_edges.begin(), back_edges.end(), std::make_pair((int)val->input->id, (int)op->id)) ? 1 : 0;
+            edges.push_back(std::make_tuple(val->input->id, op->id, distance));
+        }
+    }
+
+    // a cycle with more latency than II times its distance is a positive cycle in the graph weighted with
+    // latency - II * distance, found with Bellman-Ford on the longest paths. Every cycle has a distance of
+    // at least one, so there is none once the II reaches the total latency.
+    for(int II = 1; II < std::max(total_latency, 1); II++)
+    {
+        std::vector<int> length(num_ops, 0);
+        bool relaxed = true;
+        for(int i = 0; i < num_ops && relaxed; i++)
+        {
+            relaxed = false;
+            for(auto & e : edges)
+            {
+                int l = length[std::get<0>(e)] + latency[std::get<0>(e)] - II * std::get<2>(e);
+                if(l > length[std::get<1>(e)])
+                {
+                    length[std::get<1>(e)] = l;
+                    relaxed = true;
+                }
+            }
+        }
+        if(!relaxed)
+            return II;
+    }
+    return std::max(total_latency, 1);
+}
+
+// II sweep: each II from max(ResMII, RecMII) to cgra->maxII is mapped by its own copy of this mapper, with as many IIs
+// in flight as there are cores, lowest first. Once an II is mapped, the attempts at higher IIs are
+// cancelled and not started. The lower IIs still running carry on until they map or fail, so the
+// mapping returned is at the lowest II that the mapper can map. The attempts are quiet, only the result
+// of the sweep is printed.
+Mapping Mapper::mapOpGraph(std::shared_ptr<OpGraph> opgraph)
+{
+    const int max_II = cgra->maxII;
+    if(max_II < 1)
+        throw cgrame_error("Mapper Exception: the maximum II of the architecture is not set");
+
+    // IIs below the lower bounds can not be mapped
+    int res_II = getResMII(opgraph.get());
+    int rec_II = getRecMII(opgraph.get());
+    int min_II = std::max(res_II, rec_II);
+    std::cout << "[INFO] II Sweep: ResMII is " << res_II << ", RecMII is " << rec_II << std::endl;
+    if(min_II > max_II)
+    {
+        std::cout << "[INFO] II Sweep: No Mapping Possible up to II " << max_II << std::endl;
+        std::cout << "Mapped: 0" << std::endl;
+        return Mapping(cgra, max_II, opgraph);
+    }
+
+    // the MRRGs are created here, one at a time, the attempts only read them
+    for(int ii = max_II; ii >= 1; ii--)
+        cgra->getMRRG(ii);
+
+    // indexed by II
+    std::unique_ptr<std::atomic<bool>[]> cancel(new std::atomic<bool>[max_II + 1]);
+    std::vector<std::unique_ptr<Mapper>> attempts(max_II + 1);
+    std::vector<std::unique_ptr<Mapping>> results(max_II + 1);
+    for(int ii = 0; ii <= max_II; ii++)
+        cancel[ii] = false;
+
+    std::mutex lock;
+    int next_II = min_II;
+    int best_II = max_II + 1;
+    std::exception_ptr error;
+    auto worker = [&]()
+    {
+        while(true)
+        {
+            int ii;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if(next_II >= best_II)
+                    return;
+                ii = next_II++;
+                attempts[ii] = clone();
+                attempts[ii]->setSweepAttempt(&cancel[ii]);
+            }
+
+            Mapping result(cgra, ii, opgraph);
+            try
+            {
+                result = attempts[ii]->mapOpGraph(opgraph, ii);
+            }
+            catch(...)
+            {
+                // stop the sweep, the error is rethrown once all attempts have returned
+                std::lock_guard<std::mutex> guard(lock);
+                if(!error)
+                    error = std::current_exception();
+                next_II = max_II + 1;
+                for(int other = 1; other <= max_II; other++)
+                    cancel[other] = true;
+                return;
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            results[ii].reset(new Mapping(result));
+            if(result.isMapped() && ii < best_II)
+            {
+                best_II = ii;
+                for(int higher = ii + 1; higher <= max_II; higher++)
+                    cancel[higher] = true;
+            }
+        }
+    };
+
+    int num_threads = std::max(1, std::min(max_II, (int)std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for(int t = 0; t < num_threads; t++)
+        threads.emplace_back(worker);
+    for(auto & t : threads)
+        t.join();
+
+    if(error)
+        std::rethrow_exception(error);
+
+    if(best_II > max_II)
+    {
+        std::cout << "[INFO] II Sweep: No Mapping Found up to II " << max_II << std::endl;
+        std::cout << "Mapped: 0" << std::endl;
+        return *results[max_II];
+    }
+
+    std::cout << "[INFO] II Sweep: Minimum II is " << best_II << std::endl;
+    std::cout << "Mapped: 1" << std::endl;
+    attempts[best_II]->updateOpGraph(opgraph.get());
+    return *results[best_II];
+}
@@ -195,6 +195,15 @@ OpGraph::~OpGraph()
 {
 }
 
+void OpGraph::finalize()
+{
+    unsigned int id = 0;
+    for(auto & op : op_nodes)
+        op->id = id++;
+    for(auto & val : val_nodes)
+        val->id = id++;
+}
+
 std::ostream& operator<<(std::ostream& output, const OpGraphOp& op)
 {
     output << op.name << "(" << op.opcode <<")";
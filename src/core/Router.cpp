@@ -0,0 +1,175 @@
+/*******************************************************************************
+ * CGRA-ME Software End-User License Agreement
+ *
+ * The software programs comprising "CGRA-ME" and the documentation provided
+ * with them are copyright by its authors S. Chin, K. Niu, N. Sakamoto, J. Zhao,
+ * A. Rui, S. Yin, A. Mertens, J. Anderson, and the University of Toronto. Users
+ * agree to not redistribute the software, in source or binary form, to other
+ * persons or other institutions. Users may modify or use the source code for
+ * other non-commercial, not-for-profit research endeavours, provided that all
+ * copyright attribution on the source code is retained, and the original or
+ * modified source code is not redistributed, in whole or in part, or included
+ * in or with any commercial product, except by written agreement with the
+ * authors, and full and complete attribution for use of the code is given in
+ * any resulting publications.
+ *
+ * Only non-commercial, not-for-profit use of this software is permitted. No
+ * part of this software may be incorporated into a commercial product without
+ * the written consent of the authors. The software may not be used for the
+ * design of a commercial electronic product without the written consent of the
+ * authors. The use of this software to assist in the development of new
+ * commercial CGRA architectures or commercial soft processor architectures is
+ * also prohibited without the written consent of the authors.
+ *
+ * This software is provided "as is" with no warranties or guarantees of
+ * support.
+ *
+ * This Agreement shall be governed by the laws of Province of Ontario, Canada.
+ *
+ * Please contact Prof. Anderson if you are interested in commercial use of the
+ * CGRA-ME framework.
+ ******************************************************************************/
+
+#include <iostream>
+#include <cassert>
+
+#include <CGRA/Router.h>
+
+NegotiatedRouter::NegotiatedRouter(MRRG* mrrg, int max_iterations, float initial_present_factor, float present_factor_mult, float history_factor, float astar_factor)
+    : mrrg(mrrg)
+    , max_iterations(max_iterations)
+    , initial_present_factor(initial_present_factor)
+    , present_factor_mult(present_factor_mult)
+    , history_factor(history_factor)
+    , astar_factor(astar_factor)
+    , verbose(true)
+    , present_factor(initial_present_factor)
+    , iterations(0)
+    , unroutable_val(NULL)
+{
+}
+
+// PathFinder cost: (base + history) * present congestion penalty, where the penalty is
+// for the overuse the node would have if this val was added to it.
+float NegotiatedRouter::getCost(MRRGNode* n) const
+{
+    int overuse = occupancy[n->id] + 1 - n->capacity;
+    float present = 1.0 + (overuse > 0 ? overuse * present_factor : 0.0);
+
+    return (1.0 + history[n->id]) * present;
+}
+
+void NegotiatedRouter::ripUpVal(OpGraphVal* val)
+{
+    for(auto & n : routes[val->id])
+    {
+        occupancy[n->id]--;
+    }
+    routes[val->id].clear();
+}
+
+bool NegotiatedRouter::routeVal(OpGraphVal* val, const std::vector<MRRGNode*>& placement)
+{
+    sinks.resize(val->output.size());
+    for(unsigned int i = 0; i < val->output.size(); ++i)
+    {
+        sinks[i] = placement[val->output[i]->id]->operand[val->output_operand[i]];
+    }
+
+    if(!routeTree(scratch, *mrrg, astar_factor, placement[val->input->id], sinks, [this](MRRGNode* n) { return getCost(n); }, tree, latency))
+        return false;
+
+    for(auto & n : tree)
+    {
+        if(n->type == MRRG_NODE_ROUTING)
+        {
+            routes[val->id].push_back(n);
+            occupancy[n->id]++;
+        }
+    }
+    latencies[val->id] = latency;
+
+    return true;
+}
+
+bool NegotiatedRouter::route(OpGraph* opgraph, const std::vector<MRRGNode*>& placement)
+{
+    occupancy.assign(mrrg->getNumNodes(), 0);
+    history.assign(mrrg->getNumNodes(), 0.0);
+    routes.assign(opgraph->op_nodes.size() + opgraph->val_nodes.size(), std::vector<MRRGNode*>());
+    latencies.assign(opgraph->op_nodes.size() + opgraph->val_nodes.size(), std::vector<unsigned int>());
+    scratch.resize(mrrg->getNumNodes());
+    present_factor = initial_present_factor;
+    iterations = 0;
+    unroutable_val = NULL;
+    overused_nodes.clear();
+
+    // the placement is fixed, so overused FUs can not be fixed by routing
+    for(auto & op : opgraph->op_nodes)
+    {
+        MRRGNode* fu = placement[op->id];
+        assert(fu && fu->canMapOp(op));
+        if(++occupancy[fu->id] > fu->capacity)
+            return false;
+    }
+    placed.assign(placement.begin(), placement.begin() + opgraph->op_nodes.size());
+
+    while(iterations < max_iterations)
+    {
+        iterations++;
+
+        // rip up and reroute every val
+        for(auto & val : opgraph->val_nodes)
+        {
+            ripUpVal(val);
+            if(!routeVal(val, placement))
+            {
+                if(verbose)
+                    std::cout << "Could not route val: \"" << *val << "\". It is likely that there is a disconnect in the architecture." << std::endl;
+                unroutable_val = val;
+                return false;
+            }
+        }
+
+        // update history costs and check for overuse
+        bool overused = false;
+        for(auto & n : mrrg->routing_nodes)
+        {
+            int overuse = occupancy[n->id] - n->capacity;
+            if(overuse > 0)
+            {
+                history[n->id] += overuse * history_factor;
+                overused = true;
+            }
+        }
+
+        if(!overused)
+            return true;
+
+        present_factor *= present_factor_mult;
+    }
+
+    for(auto & n : mrrg->routing_nodes)
+    {
+        if(occupancy[n->id] > n->capacity)
+            overused_nodes.push_back(n);
+    }
+
+    return false;
+}
+
+std::map<OpGraphNode*, std::vector<MRRGNode*>> NegotiatedRouter::getMapping(OpGraph* opgraph) const
+{
+    std::map<OpGraphNode*, std::vector<MRRGNode*>> result;
+    for(auto & op : opgraph->op_nodes)
+    {
+        result[op].push_back(placed[op->id]);
+    }
+    for(auto & val : opgraph->val_nodes)
+    {
+        result[val] = routes[val->id];
+    }
+
+    return result;
+}
+
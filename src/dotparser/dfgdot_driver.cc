@@ -82,6 +82,9 @@ bool driver::finalize()
         opgraph->outputs.push_back((*it).second);
     }
 
+    // assign node ids
+    opgraph->finalize();
+
     return true;
 }
 
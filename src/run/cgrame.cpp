@@ -78,7 +78,9 @@ int main(int argc, char* argv[])
     std::string arch_opts;
     MapperType mapper_type;
     std::string mapper_opts;
-    int II;
+    std::string resume_filename;
+    int II; // 0 for an II sweep
+    int max_II;
     double timelimit;
     bool printarch;
     bool printop;
@@ -98,10 +100,12 @@ int main(int argc, char* argv[])
             ("arch-list", "Show the List of Avaliable C++ Architectures with IDs", cxxopts::value<bool>())
             ("arch-opts", "C++ Architecture Options that Overwrites the Default Ones (<Key>=<Value> Pairs, Separate by Space, and Close by Quotation Marks)", cxxopts::value<std::string>(), "<\"opts\">")
             ("arch-opts-list", "Show the List of Avaliable Options for a C++ Architecture, ID # Generated from --arch-list", cxxopts::value<int>(), "<#>")
-            ("i,II", "Architecture Contexts", cxxopts::value<int>()->default_value("1"), "<#>")
+            ("i,II", "Architecture Contexts, or auto to Map at the Lowest II up to --max-II", cxxopts::value<std::string>()->default_value("1"), "<#|auto>")
+            ("max-II", "Largest II Tried by --II auto if the Architecture Does Not Set One", cxxopts::value<int>()->default_value("8"), "<#>")
             ("g,dfg", "The DFG file to map in dot format", cxxopts::value<std::string>())
             ("m,mapper", "Which Mapper to Use (0 = ILP, 1 = Simulated Annealing)", cxxopts::value<int>()->default_value("0"), "<#>")
             ("mapper-opts", "Mapper Options that Overwrites the Default Ones (<Key>=<Value> Pairs, Separate by Space, and Close by Quotation Marks)", cxxopts::value<std::string>(), "<\"opts\">")
+            ("resume", "Resume the Simulated Annealing Mapper from a Checkpoint File (See AnnealMapper.checkpoint_file)", cxxopts::value<std::string>(), "<Filepath>")
             ("v,visual", "Output visualization directory after mapping", cxxopts::value<bool>())
             ("t,timelimit", "Mapper Timelimit", cxxopts::value<double>()->default_value("7200.0"), "<#>")
             ("a,print-arch", "Print Architecture to stdout", cxxopts::value<bool>())
@@ -181,7 +185,28 @@ int main(int argc, char* argv[])
         arch_opts = options["arch-opts"].as<std::string>();
         mapper_type = static_cast<MapperType>(options["mapper"].as<int>());
         mapper_opts = options["mapper-opts"].as<std::string>();
-        II = options["II"].as<int>();
+        resume_filename = options["resume"].as<std::string>();
+        std::string II_option = options["II"].as<std::string>();
+        if(II_option == "auto")
+            II = 0;
+        else
+        {
+            std::size_t end = 0;
+            try
+            {
+                II = std::stoi(II_option, &end);
+            }
+            catch(const std::exception &)
+            {
+                end = 0;
+            }
+            if(end != II_option.size() || II < 1)
+            {
+                std::cout << "[ERROR] II Must be a Positive Integer or auto: " << II_option << std::endl;
+                return 1;
+            }
+        }
+        max_II = options["max-II"].as<int>();
         timelimit = options["timelimit"].as<double>();
         printarch = options["print-arch"].as<bool>();
         printop = options["print-op"].as<bool>();
@@ -350,10 +375,28 @@ int main(int argc, char* argv[])
                 std::cout << "[WARNING] Mapper Parameter: " << key << " doesn't exist, Skipping: " << key << " = " << value << std::endl;
         }
 
+        if(!resume_filename.empty())
+        {
+            if(mapper_type != MapperType::AnnealMapper)
+            {
+                std::cout << "[ERROR] Only the Simulated Annealing Mapper Can Resume from a Checkpoint" << std::endl;
+                return 1;
+            }
+            if(II == 0)
+            {
+                std::cout << "[ERROR] A Checkpoint Can Only be Resumed at its own II, not with --II auto" << std::endl;
+                return 1;
+            }
+            mapper_args["AnnealMapper.resume_file"] = resume_filename;
+        }
+
+        if(II == 0 && arch->maxII < 1)
+            arch->maxII = max_II;
+
         std::cout << "[INFO] Creating Mapper..." << std::endl;
         auto mapper = Mapper::createMapper(mapper_type, arch, timelimit, mapper_args);
 
-        Mapping mapping_result = mapper->mapOpGraph(opgraph, II);
+        Mapping mapping_result = (II == 0) ? mapper->mapOpGraph(opgraph) : mapper->mapOpGraph(opgraph, II);
 
         if(mapping_result.isMapped())
         {